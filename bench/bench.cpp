@@ -0,0 +1,382 @@
+/// @file   bench.cpp
+/// @brief  Benchmarks of k-gram counting, querying, scoring and sampling
+/// @author Valerio Gherardi
+/// @details Standalone program, built against the C++ sources of the package
+/// (no R required), see bench/README.md. Results are written to standard
+/// output in JSON Lines format, one record per measurement.
+
+#include "Smoothing.h"
+#include "Sampler.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <map>
+
+//--------Options--------//
+
+struct Options {
+        std::string name = "";    ///< @brief Corpus name, used in output
+        std::string train = "";   ///< @brief Training corpus file
+        std::string test = "";    ///< @brief Test corpus file
+        size_t sentences = 100000; ///< @brief Zipf: training sentences
+        size_t test_sentences = 10000; ///< @brief Zipf: test sentences
+        size_t vocab = 10000;     ///< @brief Zipf: vocabulary size
+        double exponent = 1.1;    ///< @brief Zipf: exponent
+        size_t min_length = 3;    ///< @brief Zipf: min sentence length
+        size_t max_length = 25;   ///< @brief Zipf: max sentence length
+        size_t seed = 840;        ///< @brief Random seed
+        size_t N = 3;             ///< @brief Order of k-gram models
+        size_t reps = 5;          ///< @brief Repetitions of each measurement
+        size_t n_samples = 100;   ///< @brief Number of sampled sentences
+        std::string only = "";    ///< @brief Comma separated benchmarks
+};
+
+void usage () {
+        std::cerr <<
+"Usage: kgrams_bench [options]\n"
+"\n"
+"Corpus (text files, one sentence per line):\n"
+"  --train FILE            training corpus\n"
+"  --test FILE             test corpus\n"
+"  --name NAME             corpus name in output\n"
+"Synthetic Zipfian corpus (used if --train is not given):\n"
+"  --sentences N           training sentences (default 100000)\n"
+"  --test-sentences N      test sentences (default 10000)\n"
+"  --vocab V               vocabulary size (default 10000)\n"
+"  --exponent S            Zipf exponent (default 1.1)\n"
+"  --min-length L          minimum sentence length (default 3)\n"
+"  --max-length L          maximum sentence length (default 25)\n"
+"  --seed SEED             random seed (default 840)\n"
+"Benchmarks:\n"
+"  --order N               order of k-gram models (default 3)\n"
+"  --reps R                repetitions of each measurement (default 5)\n"
+"  --samples N             sentences sampled per smoother (default 100)\n"
+"  --only LIST             comma separated subset of: count, query,\n"
+"                          prob, sentence, sample\n";
+}
+
+using Setter = std::function<void(const std::string &)>;
+Setter set (std::string & x) { return [&x](const std::string & v) { x = v; }; }
+Setter set (size_t & x) 
+        { return [&x](const std::string & v) { x = std::stoul(v); }; }
+Setter set (double & x) 
+        { return [&x](const std::string & v) { x = std::stod(v); }; }
+
+Options parse_options (int argc, char ** argv) {
+        Options opt;
+        std::map<std::string, Setter> setters{
+                {"--name", set(opt.name)},
+                {"--train", set(opt.train)},
+                {"--test", set(opt.test)},
+                {"--sentences", set(opt.sentences)},
+                {"--test-sentences", set(opt.test_sentences)},
+                {"--vocab", set(opt.vocab)},
+                {"--exponent", set(opt.exponent)},
+                {"--min-length", set(opt.min_length)},
+                {"--max-length", set(opt.max_length)},
+                {"--seed", set(opt.seed)},
+                {"--order", set(opt.N)},
+                {"--reps", set(opt.reps)},
+                {"--samples", set(opt.n_samples)},
+                {"--only", set(opt.only)}
+        };
+        for (int i = 1; i < argc; ++i) {
+                std::string arg = argv[i];
+                auto it = setters.find(arg);
+                if (it == setters.end() or i + 1 == argc) {
+                        usage();
+                        std::exit(arg == "--help" ? 0 : 1);
+                }
+                it->second(argv[++i]);
+        }
+        if (opt.N == 0 or opt.reps == 0 or opt.vocab == 0 or
+            opt.min_length > opt.max_length or
+            (opt.train != "" and opt.test == ""))
+        {
+                usage();
+                std::exit(1);
+        }
+        if (opt.name == "") {
+                std::ostringstream name;
+                if (opt.train != "")
+                        name << opt.train;
+                else
+                        name << "zipf-" << opt.sentences << "-" << opt.vocab
+                             << "-" << opt.exponent;
+                opt.name = name.str();
+        }
+        return opt;
+}
+
+//--------Corpora--------//
+
+std::vector<std::string> read_lines (const std::string & path) {
+        std::ifstream in(path);
+        if (not in) {
+                std::cerr << "Could not open file '" << path << "'.\n";
+                std::exit(1);
+        }
+        std::vector<std::string> res;
+        std::string line;
+        while (std::getline(in, line))
+                res.push_back(line);
+        return res;
+}
+
+/// @brief Random sentences, with words drawn independently from a Zipf
+/// distribution over the vocabulary {w1, w2, ..., wV}, and lengths drawn
+/// uniformly between min_length and max_length.
+std::vector<std::string> zipf_corpus (size_t n,
+                                      const Options & opt,
+                                      std::mt19937_64 & gen)
+{
+        std::vector<double> weights(opt.vocab);
+        for (size_t r = 0; r < opt.vocab; ++r)
+                weights[r] = std::pow(r + 1, -opt.exponent);
+        std::discrete_distribution<size_t> word(weights.begin(), weights.end());
+        std::uniform_int_distribution<size_t> length(opt.min_length,
+                                                     opt.max_length);
+        std::vector<std::string> res(n);
+        for (std::string & sentence : res) {
+                size_t len = length(gen);
+                for (size_t i = 0; i < len; ++i) {
+                        if (i) sentence += " ";
+                        sentence += "w" + std::to_string(word(gen) + 1);
+                }
+        }
+        return res;
+}
+
+std::vector<std::string> split (const std::string & sentence) {
+        std::vector<std::string> res;
+        std::istringstream in(sentence);
+        std::string word;
+        while (in >> word)
+                res.push_back(word);
+        return res;
+}
+
+/// @brief Number of tokens, including one End-Of-Sentence per sentence.
+size_t count_tokens (const std::vector<std::string> & sentences) {
+        size_t res = 0;
+        for (const std::string & sentence : sentences)
+                res += split(sentence).size() + 1;
+        return res;
+}
+
+//--------Measurements--------//
+
+/// @brief Median wall time, in seconds, of 'reps' calls to fun().
+template<class Function>
+double time_median (size_t reps, Function fun) {
+        std::vector<double> times;
+        for (size_t r = 0; r < reps; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                fun();
+                auto end = std::chrono::steady_clock::now();
+                times.push_back(
+                        std::chrono::duration<double>(end - start).count()
+                );
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+}
+
+/// @brief Prevent computed values from being optimized away.
+volatile double sink;
+
+class Reporter {
+        const Options & opt_;
+        std::string escape (const std::string & x) const {
+                std::string res;
+                for (char c : x) {
+                        if (c == '"' or c == '\\') res += '\\';
+                        res += c;
+                }
+                return res;
+        }
+public:
+        Reporter (const Options & opt) : opt_(opt) {}
+        /// @brief Write a JSON record of a measurement.
+        /// @param n Number of operations timed.
+        void operator() (std::string benchmark,
+                         std::string smoother,
+                         std::string metric,
+                         double value,
+                         size_t n) const
+        {
+                std::cout << "{\"benchmark\":\"" << benchmark << "\""
+                          << ",\"corpus\":\"" << escape(opt_.name) << "\""
+                          << ",\"N\":" << opt_.N
+                          << ",\"smoother\":"
+                          << (smoother == "" ? "null" : "\"" + smoother + "\"")
+                          << ",\"metric\":\"" << metric << "\""
+                          << ",\"value\":" << value
+                          << ",\"n\":" << n
+                          << ",\"reps\":" << opt_.reps
+                          << "}" << std::endl;
+        }
+};
+
+/// @brief All smoothers, with parameters in their typical range.
+std::vector<std::pair<std::string, std::unique_ptr<Smoother>>>
+make_smoothers (kgramFreqs & f, size_t N)
+{
+        std::vector<std::pair<std::string, std::unique_ptr<Smoother>>> res;
+        res.emplace_back("sbo", new SBOSmoother(f, N, 0.4));
+        res.emplace_back("add_k", new AddkSmoother(f, N, 1.0));
+        res.emplace_back("ml", new MLSmoother(f, N));
+        res.emplace_back("kn", new KNSmoother(f, N, 0.75));
+        res.emplace_back("mkn", new mKNSmoother(f, N, 0.25, 0.5, 0.75));
+        res.emplace_back("abs", new AbsSmoother(f, N, 0.75));
+        res.emplace_back("wb", new WBSmoother(f, N));
+        return res;
+}
+
+int main (int argc, char ** argv) {
+        std::cout.precision(10);
+        Options opt = parse_options(argc, argv);
+        auto enabled = [&opt](const std::string & benchmark) {
+                return opt.only == "" or
+                        ("," + opt.only + ",").find("," + benchmark + ",") !=
+                                std::string::npos;
+        };
+        Reporter report(opt);
+        std::mt19937_64 gen(opt.seed);
+
+        std::vector<std::string> train, test;
+        if (opt.train != "") {
+                train = read_lines(opt.train);
+                test = read_lines(opt.test);
+        } else {
+                train = zipf_corpus(opt.sentences, opt, gen);
+                test = zipf_corpus(opt.test_sentences, opt, gen);
+        }
+
+        // Counting
+        if (enabled("count")) {
+                size_t n = count_tokens(train);
+                double t = time_median(opt.reps, [&] {
+                        kgramFreqs f(opt.N);
+                        f.process_sentences(train);
+                        sink = f.tot_words();
+                });
+                report("process_sentences", "", "tokens_per_sec", n / t, n);
+        }
+
+        kgramFreqs f(opt.N);
+        f.process_sentences(train);
+
+        // Queries of all k-grams of orders 1, ..., N in the test corpus
+        if (enabled("query")) {
+                std::vector<std::string> kgrams;
+                for (const std::string & sentence : test) {
+                        std::vector<std::string> words = split(sentence);
+                        for (size_t i = 0; i < words.size(); ++i) {
+                                std::string kgram = words[i];
+                                kgrams.push_back(kgram);
+                                for (size_t k = 1; k < opt.N and k <= i; ++k) {
+                                        kgram = words[i - k] + " " + kgram;
+                                        kgrams.push_back(kgram);
+                                }
+                        }
+                }
+                size_t n = kgrams.size();
+                double t = time_median(opt.reps, [&] {
+                        double sum = 0;
+                        for (const std::string & kgram : kgrams)
+                                sum += f.query(kgram);
+                        sink = sum;
+                });
+                report("query", "", "ns_per_op", 1e9 * t / n, n);
+        }
+
+        auto smoothers = make_smoothers(f, opt.N);
+
+        // Word probabilities, given precomputed context states
+        if (enabled("prob")) {
+                const Smoother & s = *smoothers.front().second;
+                std::vector<std::pair<std::string, State>> tokens;
+                for (const std::string & sentence : test) {
+                        State state = s.initial_state();
+                        for (const std::string & word : split(sentence)) {
+                                tokens.emplace_back(word, state);
+                                s.advance(state, s.id(word), state);
+                        }
+                        tokens.emplace_back(EOS_TOK, state);
+                }
+                size_t n = tokens.size();
+                for (const auto & smoother : smoothers) {
+                        const Smoother & sm = *smoother.second;
+                        double t = time_median(opt.reps, [&] {
+                                double sum = 0;
+                                for (const auto & token : tokens)
+                                        sum += sm(token.first, token.second);
+                                sink = sum;
+                        });
+                        report("word_probability", smoother.first,
+                               "ns_per_word", 1e9 * t / n, n);
+                }
+        }
+
+        // Sentence probabilities
+        if (enabled("sentence")) {
+                size_t n = test.size();
+                for (const auto & smoother : smoothers) {
+                        const Smoother & sm = *smoother.second;
+                        double t = time_median(opt.reps, [&] {
+                                double sum = 0;
+                                for (const std::string & sentence : test)
+                                        sum += sm(sentence, true).first;
+                                sink = sum;
+                        });
+                        report("sentence_probability", smoother.first,
+                               "sentences_per_sec", n / t, n);
+                }
+        }
+
+        // Random text generation, with words counted as in sample_sentences()
+        if (enabled("sample")) {
+                std::uniform_real_distribution<double> dist(0., 1.);
+                auto unif = [&] { return dist(gen); };
+                const size_t max_length = 100;
+                for (const auto & smoother : smoothers) {
+                        // Maximum-Likelihood probabilities are undefined for 
+                        // unseen contexts
+                        if (smoother.first == "ml")
+                                continue;
+                        const Smoother & sm = *smoother.second;
+                        std::unique_ptr<Sampler> sampler;
+                        double t_setup = time_median(opt.reps, [&] {
+                                sampler.reset(new Sampler(sm));
+                        });
+                        report("sampler_setup", smoother.first, "sec",
+                               t_setup, 1);
+                        size_t n = 0;
+                        double t = time_median(opt.reps, [&] {
+                                n = 0;
+                                for (size_t i = 0; i < opt.n_samples; ++i) {
+                                        State state = sm.initial_state();
+                                        for (size_t j = 0; j < max_length; ++j)
+                                        {
+                                                ++n;
+                                                int w = sampler->sample(
+                                                        state, unif
+                                                        );
+                                                if (w == EOS_ID) break;
+                                                sm.advance(state, w, state);
+                                        }
+                                }
+                        });
+                        report("sample", smoother.first, "words_per_sec",
+                               n / t, n);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,131 @@
+#include "BeamSearch.h"
+#include "WordStream.h"
+#include <unordered_map>
+#include <algorithm>
+
+/// @brief Find the best completions of a sentence prefix.
+/// @param prefix A string. Beginning of the sentence to be completed, padded
+/// with Begin-Of-Sentence tokens as in Smoother::operator(). May be empty.
+/// @param max_length A positive integer. Maximum number of generated words,
+/// including the End-Of-Sentence token.
+/// @param n_best A positive integer. Maximum number of completions returned.
+/// @param res A vector of Completion's. Output completions: the ones ending
+/// with the End-Of-Sentence token, sorted by decreasing score, followed by
+/// the ones truncated at 'max_length' words (if any), also sorted by
+/// decreasing score.
+/// @details The Unknown-Word token and words with zero probability are never
+/// generated, see Smoother::top_k(). Ties are broken in favor of the
+/// hypotheses found first, so that the output is deterministic.
+void BeamSearch::operator() (const std::string & prefix,
+                             size_t max_length,
+                             size_t n_best,
+                             std::vector<Completion> & res) const
+{
+        std::vector<Context> contexts;
+        std::unordered_map<std::string, size_t> context_index;
+        // Index of the (shared) context state 'state'
+        auto intern = [&](const State & state) {
+                auto it = context_index.find(state.keys.back());
+                if (it != context_index.end())
+                        return it->second;
+                context_index[state.keys.back()] = contexts.size();
+                contexts.emplace_back();
+                contexts.back().state = state;
+                return contexts.size() - 1;
+        };
+        // Resolve context dependent terms and best continuations of a context
+        auto expand = [&](Context & c) {
+                if (c.expanded)
+                        return;
+                smoother_.resolve(c.state);
+                SparseProbs top;
+                smoother_.top_k(c.state, width_, top);
+                for (const auto & p : top) {
+                        // Same values as Smoother::prob()
+                        double prob = smoother_.prob(p.first, c.state);
+                        if (prob > 0)
+                                c.next.emplace_back(p.first, prob);
+                }
+                c.expanded = true;
+        };
+
+        State start = smoother_.initial_state();
+        WordStream ws(prefix);
+        std::string word;
+        while ((word = ws.pop_word()) != EOS_TOK) {
+                if (word == BOS_TOK) continue;
+                smoother_.advance(start, smoother_.id(word), start);
+        }
+
+        std::vector<Node> nodes{Node{0, BOS_ID, 0., 0, intern(start)}};
+        std::vector<size_t> beam{0}, finished;
+        std::vector<Node> candidates;
+        auto better = [](const Node & x, const Node & y)
+                { return x.log_prob > y.log_prob; };
+        for (size_t length = 1; length <= max_length; ++length) {
+                if (beam.empty() or finished.size() >= width_)
+                        break;
+                candidates.clear();
+                for (size_t i : beam) {
+                        // 'contexts' is not modified while 'c' is in use
+                        Context & c = contexts[nodes[i].context];
+                        expand(c);
+                        for (const auto & p : c.next)
+                                candidates.push_back(Node{
+                                        i, p.first,
+                                        nodes[i].log_prob + std::log(p.second),
+                                        length, 0
+                                        });
+                }
+                size_t n = std::min(width_, candidates.size());
+                std::stable_sort(candidates.begin(), candidates.end(), better);
+                candidates.resize(n);
+
+                beam.clear();
+                for (Node & node : candidates) {
+                        if (node.word == EOS_ID) {
+                                finished.push_back(nodes.size());
+                        } else {
+                                const Node & parent = nodes[node.parent];
+                                State state;
+                                smoother_.advance(
+                                        contexts[parent.context].state,
+                                        node.word,
+                                        state
+                                        );
+                                node.context = intern(state);
+                                beam.push_back(nodes.size());
+                        }
+                        nodes.push_back(node);
+                }
+        }
+
+        auto completion = [&](size_t i, bool complete) {
+                Completion c;
+                c.log_prob = nodes[i].log_prob;
+                c.score = score(c.log_prob, nodes[i].length);
+                c.complete = complete;
+                if (complete)
+                        i = nodes[i].parent;
+                for (; i != 0; i = nodes[i].parent)
+                        c.words.push_back(nodes[i].word);
+                std::reverse(c.words.begin(), c.words.end());
+                return c;
+        };
+        auto by_score = [](const Completion & x, const Completion & y)
+                { return x.score > y.score; };
+
+        res.clear();
+        for (size_t i : finished)
+                res.push_back(completion(i, true));
+        std::stable_sort(res.begin(), res.end(), by_score);
+        size_t n_complete = res.size();
+        // Open hypotheses left in the beam have reached 'max_length', unless
+        // the search stopped early
+        if (finished.size() < width_)
+                for (size_t i : beam)
+                        res.push_back(completion(i, false));
+        std::stable_sort(res.begin() + n_complete, res.end(), by_score);
+        if (res.size() > n_best)
+                res.resize(n_best);
+}
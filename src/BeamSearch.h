@@ -0,0 +1,81 @@
+/// @file   BeamSearch.h
+/// @brief  Definition of BeamSearch class
+/// @author Valerio Gherardi
+
+#ifndef BEAM_SEARCH_H
+#define BEAM_SEARCH_H
+
+#include "Smoothing.h"
+#include <vector>
+#include <string>
+#include <cmath>
+
+/// @struct Completion
+/// @brief A sentence completion found by BeamSearch.
+struct Completion {
+        std::vector<int> words; ///< @brief Generated words, excluding EOS
+        double log_prob; ///< @brief Log-probability of the generated words
+        double score; ///< @brief Length normalized log-probability
+        bool complete; ///< @brief Whether the completion ends with EOS
+};
+
+/// @class BeamSearch
+/// @brief Deterministic best-first completion of sentence prefixes.
+/// @details At each step, each of the (at most) 'width' open hypotheses of
+/// the beam is extended by its 'width' most probable continuations, see
+/// Smoother::top_k(), and the 'width' best extensions by log-probability are
+/// retained. Extensions ending with the End-Of-Sentence token are removed
+/// from the beam and become completions. The search stops when the beam is
+/// empty, when 'width' completions have been found, or when the maximum
+/// length is reached.
+///
+/// Hypotheses are stored as a tree of nodes, so that common prefixes are
+/// shared. Context states are also shared among hypotheses ending with the
+/// same N - 1 words: context dependent terms (see Smoother::context_weights())
+/// and continuations of each distinct context are computed only once per
+/// search.
+class BeamSearch {
+        /// @brief Node of the hypothesis tree.
+        struct Node {
+                size_t parent; ///< @brief Index of the parent node
+                int word; ///< @brief Last word of the hypothesis
+                double log_prob; ///< @brief Log-probability of the hypothesis
+                size_t length; ///< @brief Number of generated words
+                size_t context; ///< @brief Index of the context state
+        };
+
+        /// @brief A context state, with resolved context dependent terms,
+        /// and its best continuations.
+        struct Context {
+                State state;
+                SparseProbs next; ///< @brief Probabilities as in prob()
+                bool expanded = false;
+        };
+
+        const Smoother & smoother_;
+        size_t width_;
+        double alpha_;
+public:
+        /// @param smoother A Smoother. Must outlive the BeamSearch object.
+        /// @param width A positive integer. Beam width.
+        /// @param alpha A non-negative number. Length normalization exponent,
+        /// see score().
+        BeamSearch (const Smoother & smoother, size_t width, double alpha = 0.)
+                : smoother_(smoother), width_(width), alpha_(alpha) {}
+
+        /// @brief Length normalized score of a hypothesis, defined as
+        /// log_prob / length ^ alpha.
+        double score (double log_prob, size_t length) const {
+                return length > 0 ?
+                        log_prob / std::pow((double)length, alpha_) : log_prob;
+        }
+
+        /// @brief Find the best completions of a sentence prefix.
+        void operator() (const std::string & prefix,
+                         size_t max_length,
+                         size_t n_best,
+                         std::vector<Completion> & res) const;
+                // BeamSearch.cpp
+}; // BeamSearch
+
+#endif // BEAM_SEARCH_H
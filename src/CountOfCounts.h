@@ -0,0 +1,79 @@
+/// @file   CountOfCounts.h
+/// @brief  Definition of CountOfCounts class
+/// @author Valerio Gherardi
+
+#ifndef COUNT_OF_COUNTS_H
+#define COUNT_OF_COUNTS_H
+
+#include <vector>
+#include <array>
+
+/// @class CountOfCounts
+/// @brief Number of distinct k-grams occurring exactly r times, for
+/// r = 1, ..., 4, and closed form estimates of discounts derived from these.
+/// @details Counts are updated incrementally by kgramFreqs, each time the
+/// count of a k-gram is increased. k-grams ending with the Begin-Of-Sentence
+/// token (i.e. paddings) are not counted, as in the continuation counts of
+/// Kneser-Ney smoothers.
+class CountOfCounts {
+        /// @brief n_[k][r - 1] is the number of k-grams with count r
+        std::vector<std::array<size_t, 4>> n_;
+public:
+        /// @brief Maximum count tracked.
+        static constexpr size_t max_count = 4;
+
+        /// @param N Positive integer. Maximum order of k-grams.
+        CountOfCounts (size_t N) : n_(N + 1, std::array<size_t, 4>{}) {}
+
+        /// @brief Drop counts of k-grams of order larger than N.
+        /// @param N Positive integer. New maximum order of k-grams.
+        void truncate (size_t N) { n_.resize(N + 1); }
+
+        /// @brief Register the increase of the count of a k-gram by one.
+        /// @param k Positive integer. Order of the k-gram.
+        /// @param count Positive integer. New count of the k-gram.
+        void increment (size_t k, size_t count) {
+                if (count >= 2 and count <= max_count + 1)
+                        --n_[k][count - 2];
+                if (count <= max_count)
+                        ++n_[k][count - 1];
+        }
+
+        /// @brief Register the increase of the count of a k-gram by an
+        /// arbitrary amount.
+        /// @param k Positive integer. Order of the k-gram.
+        /// @param from Non-negative integer. Old count of the k-gram.
+        /// @param to Positive integer. New count of the k-gram.
+        void increase (size_t k, size_t from, size_t to) {
+                if (from >= 1 and from <= max_count)
+                        --n_[k][from - 1];
+                if (to >= 1 and to <= max_count)
+                        ++n_[k][to - 1];
+        }
+
+        /// @brief Number of k-grams occurring exactly r times.
+        /// @param k Positive integer. Order of k-grams.
+        /// @param r Positive integer, not larger than max_count.
+        size_t n (size_t k, size_t r) const { return n_[k][r - 1]; }
+
+        /// @brief Estimate of the discount of k-gram counts,
+        /// D = n1 / (n1 + 2 * n2), see Ref. (Ney et al., 1994).
+        /// @param k Positive integer. Order of k-grams.
+        /// @return A number between 0 and 1. NaN if n1 = n2 = 0.
+        double D (size_t k) const {
+                double n1 = n(k, 1), n2 = n(k, 2);
+                return n1 / (n1 + 2 * n2);
+        }
+
+        /// @brief Estimate of the discount of k-gram counts equal to r
+        /// (or larger than 2, for r = 3), D_r = r - (r + 1) * D * n_{r+1} / n_r
+        /// with D as in D(k), see Ref. (Chen and Goodman, 1999).
+        /// @param k Positive integer. Order of k-grams.
+        /// @param r An integer between 1 and 3.
+        /// @return A number, not finite if n_r = 0.
+        double D (size_t k, size_t r) const {
+                return r - (r + 1) * D(k) * n(k, r + 1) / (double)n(k, r);
+        }
+}; // CountOfCounts
+
+#endif // COUNT_OF_COUNTS_H
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <stdexcept>
 
 
 /// @class Dictionary
@@ -19,24 +20,26 @@
 /// between word and k-gram tokens and word and k-gram codes (strings of 
 /// integers), where the latters are employed in the internal implementation
 /// of kgramFreqs class.
+/// @details Words are identified by integer IDs: regular words have IDs 
+/// 1, 2, ..., V, in order of insertion, while the special tokens have IDs 
+/// EOS_ID = 0, BOS_ID = -1 and UNK_ID = -2. Word indices are the string
+/// representations of these IDs.
 class Dictionary {
         //--------Private elements--------//
-        /// @brief Word-to-index map
-        std::unordered_map<std::string, std::string> word_to_ind_;
-        /// @brief Index-to-word map
-        std::unordered_map<std::string, std::string> ind_to_word_;
+        /// @brief Word-to-ID map
+        std::unordered_map<std::string, int> word_to_id_;
+        /// @brief ID-to-word map, for IDs 0, 1, ..., V (EOS and regular words)
+        std::vector<std::string> id_to_word_;
         /// @brief Size of dictionary (without BOS, EOS and UNK tokens)
         size_t V_;
         
         //--------Private elements--------//
         void insert_special_tokens() {
-                word_to_ind_[BOS_TOK] = BOS_IND;
-                ind_to_word_[BOS_IND] = BOS_TOK;
-                word_to_ind_[EOS_TOK] = EOS_IND;
-                ind_to_word_[EOS_IND] = EOS_TOK;
-                // UNK_TOK is not added as a key in Word-to-Index map, see 
+                word_to_id_[BOS_TOK] = BOS_ID;
+                word_to_id_[EOS_TOK] = EOS_ID;
+                id_to_word_.push_back(EOS_TOK);
+                // UNK_TOK is not added as a key in Word-to-ID map, see 
                 // contains() method below
-                ind_to_word_[UNK_IND] = UNK_TOK;
         }
         
 public:
@@ -61,40 +64,56 @@ public:
         /// @return true if the word is contained in the Dictionary, false 
         /// otherwise.
         bool contains (std::string word) const { 
-                return word_to_ind_.find(word) != word_to_ind_.end();
+                return word_to_id_.find(word) != word_to_id_.end();
         }
         
         /// @brief Insert a word in the Dictionary
         /// @param word A string.
         void insert (std::string word) {
                 if (contains(word)) return;
-                std::string index = std::to_string(++V_);
-                word_to_ind_[word] = index;
-                ind_to_word_[index] = word;
+                word_to_id_[word] = ++V_;
+                id_to_word_.push_back(word);
+        }
+        
+        /// @brief Return the word corresponding to a given word ID.
+        /// @param id An integer.
+        /// @return A string, word corresponding to 'id'.
+        std::string word (int id) const { 
+                if (id >= 0 and (size_t)id < id_to_word_.size()) 
+                        return id_to_word_[id];
+                if (id == BOS_ID) return BOS_TOK;
+                return UNK_TOK; 
         }
         
         /// @brief Return the word corresponding to a given word index.
         /// @param index A string.
         /// @return A string, word corresponding to 'index'.
         std::string word (std::string index) const { 
-                auto it = ind_to_word_.find(index);
-                if (it != ind_to_word_.end()) return it->second;
-                return UNK_TOK; 
+                size_t pos = 0; int id;
+                try { id = std::stoi(index, &pos); } 
+                catch (const std::exception &) { return UNK_TOK; }
+                return pos == index.length() ? word(id) : UNK_TOK;
+        }
+        
+        /// @brief Return the ID corresponding to a given word.
+        /// @param word A string.
+        /// @return An integer, ID corresponding to 'word'.
+        int id (const std::string & word) const {
+                auto it = word_to_id_.find(word);
+                if (it != word_to_id_.end()) return it->second;
+                return UNK_ID;
         }
         
         /// @brief Return the index corresponding to a given word.
         /// @param word A string.
         /// @return A string, index corresponding to 'word'.
-        std::string index (std::string word) const {
-                auto it = word_to_ind_.find(word);
-                if (it != word_to_ind_.end()) return it->second;
-                return UNK_IND;
-        }
+        std::string index (std::string word) const 
+                { return std::to_string(id(word)); }
         
         /// @brief Return size of the dictionary, excluding the special tokens
         /// (BOS, EOS, UNK).
         /// @return A positive integer. Size of the dictionary.
-        size_t length () const { return ind_to_word_.size() - 3; }
+        size_t length () const { return V_; }
 
         /// @brief Return size of the dictionary, excluding the special tokens
         /// (BOS, EOS, UNK).
@@ -1,6 +1,8 @@
 #include "DictionaryR.h"
+#include "kgramFreqsR.h"
 #include <queue>
 #include <algorithm>
+#include <unordered_map>
 #include <Rcpp.h>
 using namespace Rcpp;
 
@@ -8,7 +10,7 @@ CharacterVector DictionaryR::as_character() const {
         size_t V = length();
         CharacterVector res(V);
         for(size_t i = 1; i <= V; ++i)
-                res[i - 1] = word(std::to_string(i));
+                res[i - 1] = word((int)i);
         return res;
 }
 
@@ -22,6 +24,15 @@ LogicalVector DictionaryR::query(CharacterVector word) const
         return res;
 }
 
+IntegerVector DictionaryR::idsR(CharacterVector word) const
+{
+        size_t len = word.length();
+        IntegerVector res(len);
+        for (size_t i = 0; i < len; ++i)
+                res[i] = id(as<std::string>(word[i]));
+        return res;
+}
+
 void DictionaryR::insertR(CharacterVector word_list)
 {
         std::string str;
@@ -31,8 +42,147 @@ void DictionaryR::insertR(CharacterVector word_list)
         } 
 }
 
+/// @brief Count words in text, and arrange the counts in a max-heap.
+/// @param text A character vector. Anything delimited by one or more spaces
+/// is counted as a word, as in kgramFreqs::process_sentences(), except for
+/// the Begin-Of-Sentence and End-Of-Sentence tokens.
+/// @param heap A vector of WordCount's. Output max-heap of word counts.
+/// @return The total count of words.
+/// @details Words are counted in a single pass over text, ranking words by
+/// their first occurrence.
+double DictionaryR::make_word_heap(CharacterVector text, 
+                                   std::vector<WordCount> & heap)
+{
+        heap.clear();
+        std::unordered_map<std::string, size_t> pos;
+        double total = 0;
+        std::string sentence, word;
+        for (String s : text) {
+                sentence = s;
+                WordStream stream(sentence);
+                while (true) {
+                        word = stream.pop_word();
+                        if (stream.eos()) break;
+                        if (word == BOS_TOK or word == EOS_TOK) continue;
+                        ++total;
+                        auto it = pos.find(word);
+                        if (it != pos.end()) {
+                                ++heap[it->second];
+                                continue;
+                        }
+                        pos.emplace(word, heap.size());
+                        heap.emplace_back(word, 1, heap.size());
+                }
+        }
+        std::make_heap(heap.begin(), heap.end());
+        return total;
+}
+
+/// @brief Arrange the word counts of a kgramFreqs object in a max-heap.
+/// @param freqs A kgramFreqs.
+/// @param heap A vector of WordCount's. Output max-heap of word counts.
+/// @return The total count of words in the dictionary of 'freqs'.
+/// @details Words are ranked by their position in the dictionary of 'freqs'.
+double DictionaryR::make_word_heap(const kgramFreqs & freqs,
+                                   std::vector<WordCount> & heap)
+{
+        heap.clear();
+        size_t V = freqs.V();
+        heap.reserve(V);
+        double total = 0;
+        for (size_t id = 1; id <= V; ++id) {
+                size_t count = freqs.query(1, std::to_string(id));
+                heap.emplace_back(freqs.word((int)id), count, id);
+                total += count;
+        }
+        std::make_heap(heap.begin(), heap.end());
+        return total;
+}
+
+/// @brief Remove the most frequent word from a max-heap of word counts.
+DictionaryR::WordCount DictionaryR::pop_word_heap(std::vector<WordCount> & heap)
+{
+        std::pop_heap(heap.begin(), heap.end());
+        WordCount res = std::move(heap.back());
+        heap.pop_back();
+        return res;
+}
+
+/// @brief Insert the most frequent words, until the required fraction of the 
+/// total word count is covered (at least one word is inserted, if any).
+void DictionaryR::select_cover(std::vector<WordCount> & heap, 
+                               double total, 
+                               double target)
+{
+        double covered = 0;
+        while (not heap.empty()) {
+                WordCount wc = pop_word_heap(heap);
+                insert(wc.word);
+                covered += wc.count;
+                if (covered / total >= target) break;
+        }
+}
+
+/// @brief Insert the 'n' most frequent words, in order of decreasing count.
+void DictionaryR::select_n(std::vector<WordCount> & heap, size_t n)
+{
+        for (size_t i = 0; i < n and not heap.empty(); ++i)
+                insert(pop_word_heap(heap).word);
+}
+
+/// @brief Insert the words with count larger than or equal to 'thresh', in
+/// order of decreasing count.
+void DictionaryR::select_above(std::vector<WordCount> & heap, size_t thresh)
+{
+        while (not heap.empty() and heap.front().count >= thresh)
+                insert(pop_word_heap(heap).word);
+}
+
+void DictionaryR::insert_cover(CharacterVector text, double target)
+{
+        std::vector<WordCount> heap;
+        double total = make_word_heap(text, heap);
+        select_cover(heap, total, target);
+}
+
+void DictionaryR::insert_n(CharacterVector text, size_t n)
+{
+        std::vector<WordCount> heap;
+        make_word_heap(text, heap);
+        select_n(heap, n);
+}
+
+void DictionaryR::insert_above(CharacterVector text, size_t thresh)
+{
+        std::vector<WordCount> heap;
+        make_word_heap(text, heap);
+        select_above(heap, thresh);
+}
+
+void DictionaryR::insert_cover_freqs(const kgramFreqsR & freqs, double target)
+{
+        std::vector<WordCount> heap;
+        double total = make_word_heap(freqs, heap);
+        select_cover(heap, total, target);
+}
+
+void DictionaryR::insert_n_freqs(const kgramFreqsR & freqs, size_t n)
+{
+        std::vector<WordCount> heap;
+        make_word_heap(freqs, heap);
+        select_n(heap, n);
+}
+
+void DictionaryR::insert_above_freqs(const kgramFreqsR & freqs, size_t thresh)
+{
+        std::vector<WordCount> heap;
+        make_word_heap(freqs, heap);
+        select_above(heap, thresh);
+}
+
 RCPP_EXPOSED_CLASS(Dictionary);
 RCPP_EXPOSED_CLASS(DictionaryR);
+RCPP_EXPOSED_CLASS(kgramFreqsR);
 
 RCPP_MODULE(Dictionary) {
         class_<Dictionary>("___Dictionary")
@@ -46,6 +196,13 @@ RCPP_MODULE(Dictionary) {
                 .constructor<CharacterVector>()
                 .const_method("as_character", &DictionaryR::as_character)
                 .const_method("query", &DictionaryR::query)
+                .const_method("ids", &DictionaryR::idsR)
                 .method("insert", &DictionaryR::insertR)
+                .method("insert_cover", &DictionaryR::insert_cover)
+                .method("insert_n", &DictionaryR::insert_n)
+                .method("insert_above", &DictionaryR::insert_above)
+                .method("insert_cover_freqs", &DictionaryR::insert_cover_freqs)
+                .method("insert_n_freqs", &DictionaryR::insert_n_freqs)
+                .method("insert_above_freqs", &DictionaryR::insert_above_freqs)
         ;
 }
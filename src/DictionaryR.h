@@ -6,20 +6,35 @@
 #include <algorithm>
 #include <Rcpp.h>
 
+class kgramFreqs;
+class kgramFreqsR;
+
 class DictionaryR : public Dictionary {
+        /// @brief A word, with its count and the rank of its first occurrence.
+        /// @details The ordering is by count, with ties broken in favor of 
+        /// the word occurring first, so that the top of a max-heap of 
+        /// WordCount's is the most frequent word.
         struct WordCount {
                 std::string word;
                 size_t count;
-                WordCount (std::string w, size_t c) : word(w), count(c) {}
+                size_t rank;
+                WordCount (std::string w, size_t c, size_t r) 
+                        : word(w), count(c), rank(r) {}
                 WordCount & operator++() { count++; return *this; }
                 friend bool operator< (const WordCount & l, const WordCount & r) 
                 {
                         if (l.count != r.count) return l.count < r.count; 
-                        else return l.word > r.word;         
+                        else return l.rank > r.rank;         
                 }
         };
         
         double make_word_heap(Rcpp::CharacterVector, std::vector<WordCount> &);
+        double make_word_heap(const kgramFreqs &, std::vector<WordCount> &);
+        
+        WordCount pop_word_heap(std::vector<WordCount> &);
+        void select_cover(std::vector<WordCount> &, double, double);
+        void select_n(std::vector<WordCount> &, size_t);
+        void select_above(std::vector<WordCount> &, size_t);
         
 public:
         DictionaryR () : Dictionary() {}
@@ -31,10 +46,15 @@ public:
         
         Rcpp::LogicalVector query(Rcpp::CharacterVector word) const;
         
+        Rcpp::IntegerVector idsR(Rcpp::CharacterVector word) const;
+        
         void insertR (Rcpp::CharacterVector word_list);
         void insert_cover(Rcpp::CharacterVector text, double target);
         void insert_n(Rcpp::CharacterVector text, size_t n);
         void insert_above(Rcpp::CharacterVector text, size_t thresh);
+        void insert_cover_freqs(const kgramFreqsR & freqs, double target);
+        void insert_n_freqs(const kgramFreqsR & freqs, size_t n);
+        void insert_above_freqs(const kgramFreqsR & freqs, size_t thresh);
 };
 
 #endif
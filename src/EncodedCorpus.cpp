@@ -0,0 +1,272 @@
+#include "EncodedCorpus.h"
+#include "WordStream.h"
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace corpus_format;
+
+namespace {
+
+void put_uint (std::string & out, uint64_t x, size_t bytes) {
+        for (size_t i = 0; i < bytes; ++i, x >>= 8)
+                out.push_back((char)(x & 0xFF));
+}
+
+uint64_t get_uint (const unsigned char * p, size_t bytes) {
+        uint64_t x = 0;
+        for (size_t i = bytes; i-- > 0; )
+                x = x << 8 | p[i];
+        return x;
+}
+
+} // namespace
+
+//--------//----------------CorpusWriter----------------//--------//
+
+CorpusWriter::CorpusWriter (const std::string & path,
+                            const Dictionary & dict,
+                            bool fixed_dictionary,
+                            bool varint)
+        : out_(path, std::ios::binary | std::ios::trunc),
+          dict_(dict),
+          fixed_dictionary_(fixed_dictionary),
+          varint_(varint)
+{
+        if (not out_)
+                throw std::runtime_error("Could not open file '" + path + "'.");
+        // Placeholder header, see close()
+        out_.write(std::string(header_size, '\0').data(), header_size);
+}
+
+/// @brief Append a code to the buffer of encoded sentences.
+void CorpusWriter::put_code (uint32_t code) {
+        if (not varint_) {
+                put_uint(buffer_, code, 4);
+                return;
+        }
+        while (code >= 0x80) {
+                buffer_.push_back((char)((code & 0x7F) | 0x80));
+                code >>= 7;
+        }
+        buffer_.push_back((char)code);
+}
+
+/// @brief Encode a batch of sentences.
+/// @param sentences A vector of strings. Sentences to be encoded.
+/// @details New words are inserted in the dictionary in order of first
+/// appearance, as in kgramFreqs::process_sentences(), unless the dictionary
+/// is fixed.
+void CorpusWriter::write (const std::vector<std::string> & sentences) {
+        if (closed_)
+                throw std::logic_error("Corpus has already been closed.");
+        buffer_.clear();
+        std::string word;
+        for (const std::string & sentence : sentences) {
+                WordStream stream(sentence);
+                while (word = stream.pop_word(), not stream.eos()) {
+                        ++n_words_;
+                        if (word == BOS_TOK) {
+                                put_code(BOS_TOKEN_CODE);
+                                continue;
+                        }
+                        if (word == EOS_TOK) {
+                                put_code(EOS_TOKEN_CODE);
+                                continue;
+                        }
+                        if (not fixed_dictionary_ and not dict_.contains(word))
+                                dict_.insert(word);
+                        int id = dict_.id(word);
+                        put_code(id == UNK_ID ? UNK_CODE : id + WORD_CODE - 1);
+                }
+                put_code(EOS_CODE);
+                ++n_sentences_;
+        }
+        out_.write(buffer_.data(), buffer_.size());
+        stream_bytes_ += buffer_.size();
+        if (not out_)
+                throw std::runtime_error("Error writing encoded corpus.");
+}
+
+/// @brief Write the dictionary and header, and close the file.
+void CorpusWriter::close () {
+        if (closed_)
+                return;
+        buffer_.clear();
+        size_t V = dict_.length();
+        for (size_t id = 1; id <= V; ++id) {
+                std::string word = dict_.word((int)id);
+                put_uint(buffer_, word.size(), 4);
+                buffer_ += word;
+        }
+        out_.write(buffer_.data(), buffer_.size());
+
+        std::string header(magic, magic_size);
+        put_uint(header, version, 4);
+        put_uint(header, varint_ ? VARINT : 0, 4);
+        put_uint(header, n_sentences_, 8);
+        put_uint(header, n_words_, 8);
+        put_uint(header, stream_bytes_, 8);
+        put_uint(header, V, 8);
+        out_.seekp(0);
+        out_.write(header.data(), header.size());
+        out_.close();
+        closed_ = true;
+        if (out_.fail())
+                throw std::runtime_error("Error writing encoded corpus.");
+}
+
+//--------//----------------EncodedCorpus----------------//--------//
+
+EncodedCorpus::EncodedCorpus (const std::string & path) {
+        auto fail = [&path](const std::string & what) {
+                throw std::runtime_error(
+                        "'" + path + "' is not a valid encoded corpus (" +
+                        what + ")."
+                );
+        };
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                throw std::runtime_error("Could not open file '" + path + "'.");
+        struct stat st;
+        if (::fstat(fd, &st) == 0 and st.st_size > 0) {
+                size_ = st.st_size;
+                void * map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE,
+                                    fd, 0);
+                if (map != MAP_FAILED) {
+                        data_ = static_cast<const unsigned char *>(map);
+                        mapped_ = true;
+                }
+        }
+        ::close(fd);
+#endif
+        if (not mapped_) {
+                std::ifstream in(path, std::ios::binary);
+                if (not in)
+                        throw std::runtime_error(
+                                "Could not open file '" + path + "'."
+                        );
+                buffer_.assign(std::istreambuf_iterator<char>(in),
+                               std::istreambuf_iterator<char>());
+                data_ = buffer_.data();
+                size_ = buffer_.size();
+        }
+
+        // From here on, the destructor is not called if an exception is
+        // thrown, and the mapping is released by the catch block.
+        try {
+                if (size_ < header_size or
+                    not std::equal(magic, magic + magic_size, data_))
+                        fail("wrong header");
+                if (get_uint(data_ + 8, 4) != version)
+                        fail("unsupported version");
+                varint_ = get_uint(data_ + 12, 4) & VARINT;
+                n_sentences_ = get_uint(data_ + 16, 8);
+                n_words_ = get_uint(data_ + 24, 8);
+                stream_bytes_ = get_uint(data_ + 32, 8);
+                V_ = get_uint(data_ + 40, 8);
+                if (stream_bytes_ > size_ - header_size or V_ > size_ / 4)
+                        fail("truncated file");
+
+                const unsigned char * p = data_ + header_size + stream_bytes_,
+                        * end = data_ + size_;
+                words_.reserve(V_);
+                for (uint64_t i = 0; i < V_; ++i) {
+                        if (end - p < 4)
+                                fail("truncated dictionary");
+                        size_t len = get_uint(p, 4);
+                        p += 4;
+                        if ((size_t)(end - p) < len)
+                                fail("truncated dictionary");
+                        words_.emplace_back((const char *)p, len);
+                        p += len;
+                }
+                validate();
+        } catch (...) {
+#ifndef _WIN32
+                if (mapped_)
+                        ::munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+                throw;
+        }
+}
+
+EncodedCorpus::~EncodedCorpus () {
+#ifndef _WIN32
+        if (mapped_)
+                ::munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+}
+
+/// @brief Check that the token stream is consistent with the header.
+/// @details A single sequential pass over the stream, whose cost is
+/// negligible compared to the one of processing or scoring the corpus.
+void EncodedCorpus::validate () const {
+        auto fail = [](const std::string & what) {
+                throw std::runtime_error(
+                        "Corrupted encoded corpus (" + what + ")."
+                );
+        };
+        if (not varint_ and stream_bytes_ % 4 != 0)
+                fail("misaligned token stream");
+        if (stream_bytes_ > 0) {
+                const unsigned char * last =
+                        data_ + header_size + stream_bytes_ - (varint_ ? 1 : 4);
+                if (last[0] != 0 or (not varint_ and
+                                     (last[1] != 0 or last[2] != 0 or
+                                      last[3] != 0)))
+                        fail("unterminated sentence");
+        }
+
+        Cursor cursor = this->cursor();
+        uint32_t code;
+        uint64_t n_sentences = 0, n_words = 0;
+        while (cursor.next(code)) {
+                if (code == EOS_CODE)
+                        ++n_sentences;
+                else if (code < n_codes())
+                        ++n_words;
+                else
+                        fail("invalid word code");
+        }
+        if (n_sentences != n_sentences_ or n_words != n_words_)
+                fail("wrong number of sentences or words");
+}
+
+/// @brief Split the token stream at sentence boundaries.
+/// @param n_chunks A positive integer. Number of chunks.
+/// @return A vector of n_chunks + 1 byte offsets, the c-th chunk of the
+/// stream being [res[c], res[c + 1]).
+/// @details Chunks have approximately the same size in bytes, and may be
+/// empty. Boundaries are found by scanning forward from each split point,
+/// up to the first End-Of-Sentence token, which is possible because zero
+/// units only occur as End-Of-Sentence tokens.
+std::vector<size_t> EncodedCorpus::boundaries (size_t n_chunks) const {
+        size_t unit = varint_ ? 1 : 4;
+        const unsigned char * stream = data_ + header_size;
+        auto is_eos = [&](size_t pos) {
+                for (size_t i = 0; i < unit; ++i)
+                        if (stream[pos + i] != 0)
+                                return false;
+                return true;
+        };
+
+        std::vector<size_t> res(n_chunks + 1, stream_bytes_);
+        res[0] = 0;
+        for (size_t c = 1; c < n_chunks; ++c) {
+                size_t pos = (size_t)(c * (double)stream_bytes_ / n_chunks);
+                pos = std::max(pos - pos % unit, res[c - 1]);
+                while (pos > 0 and pos < stream_bytes_ and
+                       not is_eos(pos - unit))
+                        pos += unit;
+                res[c] = pos;
+        }
+        return res;
+}
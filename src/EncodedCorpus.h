@@ -0,0 +1,182 @@
+/// @file   EncodedCorpus.h
+/// @brief  Definition of CorpusWriter and EncodedCorpus classes
+/// @author Valerio Gherardi
+
+#ifndef ENCODED_CORPUS_H
+#define ENCODED_CORPUS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "Dictionary.h"
+
+// Binary format of encoded corpora (all integers are little-endian):
+//
+// - Header (48 bytes): the magic string "KGRMCORP", the format version and
+// flags (uint32), and the number of sentences, number of words (excluding
+// End-Of-Sentence tokens), size in bytes of the token stream and size of the
+// dictionary V (uint64).
+// - Token stream: one code per word, where 0 is the End-Of-Sentence token
+// terminating each sentence, 1 the Unknown-Word token, 2 and 3 the 
+// Begin-Of-Sentence and End-Of-Sentence tokens explicitly included in the 
+// text, and c >= 4 the (c - 3)-th word of the dictionary. Codes are stored 
+// either as raw uint32 values, or as LEB128 variable length integers (flag 
+// VARINT). In both cases, zero units (4 or 1 bytes, respectively) only occur
+// as terminating End-Of-Sentence tokens, so that sentence boundaries can be 
+// found from any position.
+// - Dictionary: V words, each stored as its length in bytes (uint32)
+// followed by its characters.
+
+namespace corpus_format {
+        const char magic[] = "KGRMCORP";
+        const size_t magic_size = 8;
+        const uint32_t version = 2;
+        const uint32_t VARINT = 1; ///< @brief Flag of varint compression
+        const size_t header_size = 48;
+        const uint32_t EOS_CODE = 0; ///< @brief End of sentence
+        const uint32_t UNK_CODE = 1;
+        const uint32_t BOS_TOKEN_CODE = 2; ///< @brief Literal BOS_TOK
+        const uint32_t EOS_TOKEN_CODE = 3; ///< @brief Literal EOS_TOK
+        const uint32_t WORD_CODE = 4; ///< @brief Code of the first word
+} // namespace corpus_format
+
+/// @class CorpusWriter
+/// @brief Encode sentences into a binary file, see EncodedCorpus.h for the
+/// format.
+/// @details Sentences are tokenized as in kgramFreqs::process_sentences(): 
+/// anything separated by one or more spaces is a word. Begin-Of-Sentence and
+/// End-Of-Sentence tokens explicitly included in sentences are encoded as 
+/// such, so that consumers can apply their own rules (e.g. scoring ignores 
+/// the former and stops at the latter, see Smoother::operator()). The 
+/// header and the dictionary are only written by close(), so that an 
+/// incomplete file is never recognized as an encoded corpus.
+class CorpusWriter {
+        std::ofstream out_;
+        Dictionary dict_;
+        bool fixed_dictionary_;
+        bool varint_;
+        uint64_t n_sentences_ = 0, n_words_ = 0, stream_bytes_ = 0;
+        std::string buffer_; ///< @brief Encoded sentences not yet written
+        bool closed_ = false;
+
+        void put_code (uint32_t code);
+public:
+        /// @param path A string. Path of the output file, which is
+        /// overwritten.
+        /// @param dict A Dictionary. Initial dictionary of the corpus.
+        /// @param fixed_dictionary true or false. If true, words not in
+        /// 'dict' are encoded as Unknown-Word tokens, otherwise they are
+        /// added to the dictionary.
+        /// @param varint true or false. Whether to use varint compression.
+        CorpusWriter (const std::string & path,
+                      const Dictionary & dict,
+                      bool fixed_dictionary,
+                      bool varint); // EncodedCorpus.cpp
+
+        /// @brief Encode a batch of sentences.
+        void write (const std::vector<std::string> &); // EncodedCorpus.cpp
+
+        /// @brief Write the dictionary and header, and close the file.
+        void close (); // EncodedCorpus.cpp
+
+        size_t n_sentences () const { return n_sentences_; }
+        size_t n_words () const { return n_words_; }
+        const Dictionary & dictionary () const { return dict_; }
+}; // CorpusWriter
+
+/// @class EncodedCorpus
+/// @brief Read-only view of a corpus encoded by CorpusWriter.
+/// @details The file is memory mapped where supported (otherwise read into
+/// memory), and fully validated on construction: consumers can assume that
+/// all codes are smaller than n_codes() and that the stream ends with an
+/// End-Of-Sentence token. An EncodedCorpus is not modified by reading, and
+/// can be safely shared among threads.
+class EncodedCorpus {
+        const unsigned char * data_ = nullptr; ///< @brief File contents
+        size_t size_ = 0; ///< @brief File size
+        std::vector<unsigned char> buffer_; ///< @brief Used if not mapped
+        bool mapped_ = false;
+
+        bool varint_;
+        uint64_t n_sentences_, n_words_, stream_bytes_, V_;
+        std::vector<std::string> words_; ///< @brief Words of codes 2, 3, ...
+
+        void validate () const; // EncodedCorpus.cpp
+public:
+        /// @class EncodedCorpus::Cursor
+        /// @brief Sequential decoder of a range of the token stream.
+        class Cursor {
+                const unsigned char * pos_, * end_;
+                bool varint_;
+        public:
+                Cursor (const unsigned char * begin,
+                        const unsigned char * end,
+                        bool varint)
+                        : pos_(begin), end_(end), varint_(varint) {}
+
+                /// @brief Decode the next code, if any.
+                /// @return false at the end of the range, true otherwise.
+                bool next (uint32_t & code) {
+                        if (pos_ >= end_)
+                                return false;
+                        if (not varint_) {
+                                code = (uint32_t)pos_[0] |
+                                        (uint32_t)pos_[1] << 8 |
+                                        (uint32_t)pos_[2] << 16 |
+                                        (uint32_t)pos_[3] << 24;
+                                pos_ += 4;
+                                return true;
+                        }
+                        code = 0;
+                        // At most five bytes for 32-bit codes
+                        for (unsigned shift = 0; shift < 32; shift += 7) {
+                                unsigned char byte = *pos_++;
+                                code |= (uint32_t)(byte & 0x7F) << shift;
+                                if (not (byte & 0x80) or pos_ >= end_)
+                                        break;
+                        }
+                        return true;
+                }
+        };
+
+        /// @param path A string. Path of a file written by CorpusWriter.
+        /// @details Throws std::runtime_error if the file cannot be read or
+        /// is not a valid encoded corpus.
+        EncodedCorpus (const std::string & path); // EncodedCorpus.cpp
+        ~EncodedCorpus (); // EncodedCorpus.cpp
+        EncodedCorpus (const EncodedCorpus &) = delete;
+        EncodedCorpus & operator= (const EncodedCorpus &) = delete;
+
+        bool varint () const { return varint_; }
+        size_t n_sentences () const { return n_sentences_; }
+        /// @brief Number of words, excluding terminating End-Of-Sentence 
+        /// tokens.
+        size_t n_words () const { return n_words_; }
+        size_t stream_bytes () const { return stream_bytes_; }
+        size_t V () const { return V_; }
+        /// @brief Number of distinct codes, i.e. V + WORD_CODE.
+        size_t n_codes () const { return V_ + corpus_format::WORD_CODE; }
+
+        /// @brief Word of a code, with code >= WORD_CODE.
+        const std::string & word (uint32_t code) const
+                { return words_[code - corpus_format::WORD_CODE]; }
+
+        /// @brief Cursor over the bytes [begin, end) of the token stream,
+        /// which must be sentence boundaries, see boundaries().
+        Cursor cursor (size_t begin, size_t end) const {
+                const unsigned char * stream = 
+                        data_ + corpus_format::header_size;
+                return Cursor(stream + begin, stream + end, varint_);
+        }
+
+        /// @brief Cursor over the whole token stream.
+        Cursor cursor () const { return cursor(0, stream_bytes_); }
+
+        /// @brief Split the token stream at sentence boundaries.
+        std::vector<size_t> boundaries (size_t n_chunks) const;
+                // EncodedCorpus.cpp
+}; // EncodedCorpus
+
+#endif // ENCODED_CORPUS_H
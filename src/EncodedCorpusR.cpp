@@ -0,0 +1,50 @@
+#include "EncodedCorpus.h"
+#include "DictionaryR.h"
+#include <Rcpp.h>
+using namespace Rcpp;
+
+/// @class CorpusWriterR
+/// @brief R interface of CorpusWriter.
+class CorpusWriterR : public CorpusWriter {
+public:
+        CorpusWriterR (std::string path,
+                       const Dictionary & dict,
+                       bool fixed_dictionary,
+                       bool varint)
+                : CorpusWriter(path, dict, fixed_dictionary, varint) {}
+
+        void writeR (CharacterVector sentence) {
+                size_t len = sentence.length();
+                std::vector<std::string> sentences(len);
+                for (size_t i = 0; i < len; ++i)
+                        sentences[i] = sentence[i];
+                write(sentences);
+        }
+
+        DictionaryR dictionaryR () const { return DictionaryR(dictionary()); }
+}; // CorpusWriterR
+
+/// @brief Header of an encoded corpus, see EncodedCorpus. The file is fully
+/// validated, and closed on return.
+List encoded_corpus_info (std::string path) {
+        EncodedCorpus corpus(path);
+        return List::create(_["n_sentences"] = (double)corpus.n_sentences(),
+                            _["n_words"] = (double)corpus.n_words(),
+                            _["V"] = (double)corpus.V(),
+                            _["varint"] = corpus.varint(),
+                            _["stream_bytes"] = (double)corpus.stream_bytes()
+                            );
+}
+
+RCPP_EXPOSED_CLASS(Dictionary);
+RCPP_EXPOSED_CLASS(DictionaryR);
+
+RCPP_MODULE(EncodedCorpus) {
+        class_<CorpusWriterR>("CorpusWriter")
+                .constructor<std::string, const Dictionary &, bool, bool>()
+                .method("write", &CorpusWriterR::writeR)
+                .method("close", &CorpusWriterR::close)
+                .const_method("dictionary", &CorpusWriterR::dictionaryR)
+        ;
+        function("encoded_corpus_info", &encoded_corpus_info);
+}
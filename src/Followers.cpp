@@ -0,0 +1,39 @@
+#include "Followers.h"
+#include "special_tokens.h"
+#include <algorithm>
+#include <cstdlib>
+
+/// @brief Build the index from k-gram frequency tables.
+/// @param freqs k-gram frequency tables, indexed by k-gram order, as
+/// stored in kgramFreqs.
+/// @details Followers of each context are sorted by decreasing count, ties 
+/// being broken by word ID, so that the index does not depend on the 
+/// iteration order of hash tables.
+void Followers::build (const std::vector<FrequencyTable> & freqs) 
+{
+        index_ = std::vector<FollowersTable>(freqs.size() - 1);
+        size_t pos;
+        std::string context;
+        for (size_t k = 1; k < freqs.size(); ++k) {
+                FollowersTable & table = index_[k - 1];
+                table.reserve(k > 1 ? freqs[k - 1].size() : 1);
+                for (const auto & p : freqs[k]) {
+                        // k-gram codes are of the form "n_1 n_2 ... n_k"
+                        // with exactly one space between word codes
+                        pos = k > 1 ? p.first.rfind(' ') + 1 : 0;
+                        int id = 
+                                std::strtol(p.first.c_str() + pos, nullptr, 10);
+                        if (id == BOS_ID) 
+                                continue;
+                        context.assign(p.first, 0, k > 1 ? pos - 1 : 0);
+                        table[context].push_back({id, p.second});
+                }
+        }
+        for (auto & table : index_)
+                for (auto & p : table) 
+                        std::sort(p.second.begin(), p.second.end(), 
+                                  [](const Follower & x, const Follower & y) {
+                                        return x.count != y.count ? 
+                                                x.count > y.count : x.id < y.id;
+                                  });
+}
@@ -0,0 +1,67 @@
+/// @file   Followers.h 
+/// @brief  Definition of Followers class 
+/// @author Valerio Gherardi
+
+#ifndef FOLLOWERS_H
+#define FOLLOWERS_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/// @struct Follower
+/// @brief A word observed after a given context, with its k-gram count.
+struct Follower {
+        int id; ///< @brief ID of the word, see Dictionary::id()
+        size_t count; ///< @brief Count of the k-gram (context, word)
+};
+
+/// @class Followers
+/// @brief Right continuation index of k-gram frequency tables.
+/// @details For each context of order 0 <= k < N, stores the list of 
+/// words observed after the context, with the corresponding k-gram counts, 
+/// sorted by decreasing count. Contexts are identified by their codes, as
+/// in the k-gram frequency tables, and the Begin-Of-Sentence token is 
+/// never listed as a follower.
+class Followers {
+        //--------Aliases--------//
+        using FrequencyTable = std::unordered_map<std::string, size_t>;
+        using FollowersTable = 
+                std::unordered_map<std::string, std::vector<Follower>>;
+        
+        //--------Private variables--------//
+        /// @brief index_[k] maps contexts of order k to their followers
+        std::vector<FollowersTable> index_;
+public:
+        /// @brief Build the index from k-gram frequency tables.
+        /// @param freqs k-gram frequency tables, indexed by k-gram order, as
+        /// stored in kgramFreqs.
+        void build (const std::vector<FrequencyTable> & freqs); 
+        
+        /// @brief Remove all entries from the index.
+        void clear () { index_.clear(); }
+        
+        /// @brief Remove the entries of contexts of order N or larger, i.e. 
+        /// those of k-grams of order larger than N.
+        void truncate (size_t N) { 
+                if (index_.size() > N) index_.resize(N); 
+                index_.shrink_to_fit();
+        }
+        
+        /// @brief Retrieve the list of followers of a context.
+        /// @param order a positive integer. Order of the context.
+        /// @param context a string. Code of the context.
+        /// @return a list of Followers, empty if the context was never 
+        /// observed.
+        const std::vector<Follower> & query (size_t order, 
+                                             const std::string & context) 
+                const 
+        {
+                static const std::vector<Follower> none;
+                if (order >= index_.size()) return none;
+                auto it = index_[order].find(context);
+                return it != index_[order].end() ? it->second : none;
+        }
+}; // Followers
+
+#endif // FOLLOWERS_H
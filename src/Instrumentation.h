@@ -0,0 +1,71 @@
+/// @file   Instrumentation.h
+/// @brief  Definition of instrumentation counters and timers
+/// @author Valerio Gherardi
+/// @details Counters are only maintained if the package is compiled with the
+/// KGRAMS_INSTRUMENT macro defined (e.g. by adding -DKGRAMS_INSTRUMENT to
+/// the compiler flags). Otherwise, Counter and ScopedTimer are empty classes
+/// whose methods do nothing, and instrumentation has no run-time cost.
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <cstdint>
+#ifdef KGRAMS_INSTRUMENT
+#include <atomic>
+#include <chrono>
+#endif
+
+/// @brief Whether instrumentation counters are maintained.
+#ifdef KGRAMS_INSTRUMENT
+constexpr bool instrumented = true;
+#else
+constexpr bool instrumented = false;
+#endif
+
+/// @class Counter
+/// @brief An event counter, which can be safely incremented by several
+/// threads, also from const methods of the owning object.
+class Counter {
+#ifdef KGRAMS_INSTRUMENT
+        mutable std::atomic<uint64_t> value_{0};
+public:
+        Counter () = default;
+        Counter (const Counter & other) : value_(other.value()) {}
+        Counter & operator= (const Counter & other)
+                { value_ = other.value(); return *this; }
+        void add (uint64_t n = 1) const
+                { value_.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value () const
+                { return value_.load(std::memory_order_relaxed); }
+        void reset () { value_ = 0; }
+#else
+public:
+        void add (uint64_t = 1) const {}
+        uint64_t value () const { return 0; }
+        void reset () {}
+#endif
+}; // Counter
+
+/// @class ScopedTimer
+/// @brief Add the time elapsed during the lifetime of the object, in
+/// nanoseconds, to a Counter.
+class ScopedTimer {
+#ifdef KGRAMS_INSTRUMENT
+        using Clock = std::chrono::steady_clock;
+        const Counter & ns_;
+        Clock::time_point start_;
+public:
+        ScopedTimer (const Counter & ns) : ns_(ns), start_(Clock::now()) {}
+        ~ScopedTimer () {
+                ns_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - start_).count());
+        }
+#else
+public:
+        ScopedTimer (const Counter &) {}
+#endif
+        ScopedTimer (const ScopedTimer &) = delete;
+        ScopedTimer & operator= (const ScopedTimer &) = delete;
+}; // ScopedTimer
+
+#endif // INSTRUMENTATION_H
@@ -0,0 +1,114 @@
+/// @file   LRUCache.h
+/// @brief  Definition of LRUCache class
+/// @author Valerio Gherardi
+
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+
+/// @class LRUCache
+/// @brief Bounded, thread-safe, Least-Recently-Used cache.
+/// @details When the cache is full, inserting a new entry evicts the least
+/// recently inserted or retrieved one. A cache of capacity zero is disabled,
+/// i.e. stores nothing. Hits and misses of get() are counted.
+template<class Key, class Value>
+class LRUCache {
+        using Entry = std::pair<Key, Value>;
+        using Iterator = typename std::list<Entry>::iterator;
+
+        size_t capacity_;
+        std::list<Entry> entries_; ///< @brief Most recently used first
+        std::unordered_map<Key, Iterator> index_;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+        mutable std::mutex mutex_;
+
+        void evict () {
+                while (entries_.size() > capacity_) {
+                        index_.erase(entries_.back().first);
+                        entries_.pop_back();
+                }
+        }
+public:
+        /// @brief Initialize an empty cache.
+        /// @param capacity a positive integer. Maximum number of entries.
+        LRUCache (size_t capacity = 0) : capacity_(capacity) {}
+
+        size_t capacity () const {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return capacity_;
+        }
+        size_t size () const {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return entries_.size();
+        }
+        size_t hits () const {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return hits_;
+        }
+        size_t misses () const {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return misses_;
+        }
+
+        /// @brief Change the capacity, evicting entries if necessary.
+        void set_capacity (size_t capacity) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                capacity_ = capacity;
+                evict();
+        }
+
+        /// @brief Retrieve an entry, marking it as the most recently used.
+        /// @param key a Key.
+        /// @param value a Value. Output value, unchanged if 'key' is missing.
+        /// @return true if the key was found, false otherwise.
+        bool get (const Key & key, Value & value) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (capacity_ == 0)
+                        return false;
+                auto it = index_.find(key);
+                if (it == index_.end()) {
+                        ++misses_;
+                        return false;
+                }
+                ++hits_;
+                entries_.splice(entries_.begin(), entries_, it->second);
+                value = it->second->second;
+                return true;
+        }
+
+        /// @brief Insert or replace an entry, as the most recently used.
+        void put (const Key & key, const Value & value) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (capacity_ == 0)
+                        return;
+                auto it = index_.find(key);
+                if (it != index_.end()) {
+                        it->second->second = value;
+                        entries_.splice(entries_.begin(), entries_, it->second);
+                        return;
+                }
+                entries_.emplace_front(key, value);
+                index_[key] = entries_.begin();
+                evict();
+        }
+
+        /// @brief Remove all entries, keeping hit/miss statistics.
+        void clear () {
+                std::lock_guard<std::mutex> lock(mutex_);
+                entries_.clear();
+                index_.clear();
+        }
+
+        /// @brief Reset hit/miss statistics.
+        void reset_stats () {
+                std::lock_guard<std::mutex> lock(mutex_);
+                hits_ = misses_ = 0;
+        }
+}; // LRUCache
+
+#endif // LRU_CACHE_H
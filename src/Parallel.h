@@ -0,0 +1,61 @@
+/// @file   Parallel.h
+/// @brief  Definition of parallel_chunks()
+/// @author Valerio Gherardi
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <exception>
+
+/// @brief Call fun(begin, end) on contiguous chunks of the range [0, len), 
+/// each processed by a separate thread.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @details Exceptions thrown by 'fun' are caught within each thread, and the
+/// first one (in order of chunks) is rethrown on the calling thread once all
+/// threads have been joined, so that these never reach std::terminate().
+template<class Function>
+void parallel_chunks (size_t len, size_t n_threads, Function fun)
+{
+        n_threads = std::max(std::min(n_threads, len), (size_t)1);
+        if (n_threads == 1) {
+                fun(0, len);
+                return;
+        }
+        
+        std::vector<std::exception_ptr> errors(n_threads);
+        std::vector<std::thread> workers;
+        workers.reserve(n_threads);
+        auto join_all = [&workers]() {
+                for (auto & worker : workers) 
+                        worker.join();
+        };
+        size_t chunk = len / n_threads, rest = len % n_threads, begin = 0, end;
+        try {
+                for (size_t t = 0; t < n_threads; ++t) {
+                        end = begin + chunk + (t < rest);
+                        std::exception_ptr & error = errors[t];
+                        workers.emplace_back([fun, &error, begin, end]() 
+                                             mutable {
+                                try {
+                                        fun(begin, end);
+                                } catch (...) {
+                                        error = std::current_exception();
+                                }
+                        });
+                        begin = end;
+                }
+        } catch (...) {
+                // Thread creation failed: wait for the running ones
+                join_all();
+                throw;
+        }
+        join_all();
+        for (const std::exception_ptr & error : errors)
+                if (error) 
+                        std::rethrow_exception(error);
+}
+
+#endif // PARALLEL_H
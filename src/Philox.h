@@ -0,0 +1,79 @@
+/// @file   Philox.h
+/// @brief  Definition of Philox class
+/// @author Valerio Gherardi
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+#include <cstddef>
+
+/// @class Philox
+/// @brief Counter-based Philox4x32-10 random number generator (Salmon et al.,
+/// "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011).
+/// @details Each output block is a bijective function of a 128-bit counter,
+/// keyed by a 64-bit seed. The upper 64 bits of the counter identify a
+/// stream, and the lower 64 bits the position within the stream, so that
+/// independent and reproducible streams can be assigned to different tasks
+/// (e.g. sentences) without any shared state, irrespectively of the thread
+/// executing them.
+class Philox {
+        uint32_t key_[2];
+        uint32_t counter_[4];
+        uint32_t block_[4];
+        size_t pos_; ///< @brief Position of the next unused word of block_
+
+        static void mulhilo (uint32_t a, uint32_t b,
+                             uint32_t & hi, uint32_t & lo)
+        {
+                uint64_t p = (uint64_t)a * b;
+                hi = p >> 32;
+                lo = (uint32_t)p;
+        }
+
+        /// @brief Compute the block of the current counter, and increment
+        /// the counter.
+        void next_block () {
+                uint32_t k0 = key_[0], k1 = key_[1];
+                uint32_t x0 = counter_[0], x1 = counter_[1],
+                         x2 = counter_[2], x3 = counter_[3];
+                for (int round = 0; round < 10; ++round) {
+                        uint32_t hi0, lo0, hi1, lo1;
+                        mulhilo(0xD2511F53, x0, hi0, lo0);
+                        mulhilo(0xCD9E8D57, x2, hi1, lo1);
+                        x0 = hi1 ^ x1 ^ k0;
+                        x1 = lo1;
+                        x2 = hi0 ^ x3 ^ k1;
+                        x3 = lo0;
+                        k0 += 0x9E3779B9;
+                        k1 += 0xBB67AE85;
+                }
+                block_[0] = x0; block_[1] = x1; block_[2] = x2; block_[3] = x3;
+                if (++counter_[0] == 0) ++counter_[1];
+                pos_ = 0;
+        }
+public:
+        /// @param seed An unsigned 64-bit integer. Key of the generator.
+        /// @param stream An unsigned 64-bit integer. Index of the stream.
+        Philox (uint64_t seed, uint64_t stream)
+                : key_{(uint32_t)seed, (uint32_t)(seed >> 32)},
+                  counter_{0, 0, (uint32_t)stream, (uint32_t)(stream >> 32)},
+                  pos_(4)
+        {}
+
+        /// @brief Next random 32-bit word of the stream.
+        uint32_t next () {
+                if (pos_ == 4)
+                        next_block();
+                return block_[pos_++];
+        }
+
+        /// @brief Uniform random number in the interval [0, 1), with 53
+        /// random bits.
+        double operator() () {
+                uint64_t a = next() >> 5, b = next() >> 6;
+                return (a * 67108864.0 + b) / 9007199254740992.0;
+        }
+}; // Philox
+
+#endif // PHILOX_H
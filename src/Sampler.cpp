@@ -0,0 +1,166 @@
+#include "Sampler.h"
+#include "Philox.h"
+#include "Parallel.h"
+#include <unordered_set>
+
+/// @brief Initialize sampler for a smoother and a temperature.
+/// @param smoother A Smoother. Must outlive the Sampler, and must not be
+/// modified while the Sampler is in use.
+/// @param T A positive number. Sampling temperature.
+/// @param top_k A non-negative integer. Maximum number of candidates of 
+/// truncated sampling, see candidates(). Zero means no limit.
+/// @param top_p A number between zero and one. Probability mass of 
+/// candidates of truncated sampling, see candidates().
+/// @details Base distributions for all context orders are computed here, so
+/// that sample() does not modify the Sampler, and can be safely called from
+/// multiple threads. For truncated sampling, words are also ranked by 
+/// decreasing base probability.
+Sampler::Sampler (const Smoother & smoother, 
+                  double T, 
+                  size_t top_k, 
+                  double top_p)
+        : smoother_(smoother), beta_(1 / T), top_k_(top_k), top_p_(top_p)
+{
+        size_t UNK_pos = smoother_.dense_index(UNK_ID);
+        for (size_t order = 0; order < smoother_.N(); ++order) {
+                size_t index = smoother_.base_index(order);
+                if (index < bases_.size() and not bases_[index].prob.empty())
+                        continue;
+                if (index >= bases_.size())
+                        bases_.resize(index + 1);
+                Base & base = bases_[index];
+                smoother_.base_distribution(order, base.prob);
+                // The Unknown-Word token is never sampled
+                base.max = 0;
+                for (size_t i = 0; i < base.prob.size(); ++i)
+                        if (i != UNK_pos)
+                                base.max = std::max(base.max, base.prob[i]);
+                base.weight.resize(base.prob.size());
+                base.cdf.resize(base.prob.size());
+                double cum = 0;
+                for (size_t i = 0; i < base.prob.size(); ++i) {
+                        base.weight[i] = i != UNK_pos ?
+                                temper(base.prob[i], base.max) : 0;
+                        cum += base.weight[i];
+                        base.cdf[i] = cum;
+                }
+                if (not truncated())
+                        continue;
+                for (size_t i = 0; i < base.weight.size(); ++i)
+                        if (base.weight[i] > 0)
+                                base.ranks.push_back(i);
+                std::stable_sort(base.ranks.begin(), base.ranks.end(),
+                                 [&base](size_t i, size_t j) {
+                                        return base.weight[i] > base.weight[j];
+                                 });
+        }
+}
+
+/// @brief Candidate words for truncated sampling, with their tempered weights.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A list of (word ID, weight) pairs. Output candidates, sorted by 
+/// decreasing weight, where weights are the tempered probabilities 
+/// Prob(w|c) ^ (1 / T), up to a common factor.
+/// @details Candidates are the most probable words (ties being broken as in
+/// Smoother::top_k()), up to a total number of 'top_k' or until their total
+/// tempered probability mass reaches a fraction 'top_p' of the total mass, 
+/// whichever comes first. Sampling a candidate with probability proportional
+/// to its weight yields the exact truncated distribution. 
+///
+/// Words are enumerated in order of decreasing probability by merging the 
+/// words in F(c), sorted by probability, with the remaining ones, whose 
+/// probability Gamma(c) * Base(w) is ordered as the precomputed ranking of
+/// the base distribution. The total mass is obtained from the one of the base 
+/// distribution by subtracting the contributions of F(c), so that the cost is
+/// proportional to the size of F(c) plus the number of candidates, rather 
+/// than to the size of the dictionary.
+void Sampler::candidates (const State & state, SparseProbs & res) const
+{
+        res.clear();
+        const Base & base = bases_[smoother_.base_index(state.order())];
+        SparseProbs probs;
+        double gamma;
+        smoother_.sparse_distribution(state, base.prob, probs, gamma);
+
+        // M: upper bound of the probabilities of all words but UNK
+        double max = gamma * base.max;
+        for (const auto & p : probs)
+                if (p.first != UNK_ID)
+                        max = std::max(max, p.second);
+        if (not (max > 0))
+                return;
+        // Tempered weight of words not in F(c), relative to base.weight
+        double wb = temper(gamma * base.max, max);
+
+        // Words in F(c), and tempered mass of words not in F(c)
+        SparseProbs F;
+        std::unordered_set<int> in_F;
+        double total = wb * base.cdf.back();
+        for (const auto & p : probs) {
+                in_F.insert(p.first);
+                size_t i = smoother_.dense_index(p.first);
+                total -= wb * base.weight[i];
+                if (p.first == UNK_ID)
+                        continue;
+                double q = temper(p.second, max);
+                if (q > 0) {
+                        F.emplace_back(p.first, q);
+                        total += q;
+                }
+        }
+        auto better = [this](const std::pair<int, double> & x, 
+                             const std::pair<int, double> & y) {
+                if (x.second != y.second) 
+                        return x.second > y.second;
+                return smoother_.dense_index(x.first) < 
+                        smoother_.dense_index(y.first);
+        };
+        std::sort(F.begin(), F.end(), better);
+
+        size_t k = top_k_ > 0 ? top_k_ : base.ranks.size() + F.size();
+        double threshold = top_p_ * total, cum = 0;
+        auto it = base.ranks.begin(), end = base.ranks.end();
+        size_t j = 0;
+        while (res.size() < k and cum < threshold) {
+                while (it != end and in_F.count(smoother_.dense_id(*it)))
+                        ++it;
+                std::pair<int, double> next;
+                bool from_base = it != end and wb * base.weight[*it] > 0;
+                if (from_base)
+                        next = {smoother_.dense_id(*it), wb * base.weight[*it]};
+                if (j < F.size() and (not from_base or better(F[j], next))) {
+                        next = F[j++];
+                } else if (from_base) {
+                        ++it;
+                } else {
+                        break;
+                }
+                res.push_back(next);
+                cum += next.second;
+        }
+}
+
+/// @brief Sample sentences in parallel, with reproducible random streams.
+/// @param n A positive integer. Number of sentences.
+/// @param max_length A positive integer. Maximum number of words per sentence,
+/// see sentence().
+/// @param seed An unsigned 64-bit integer. Seed of the random streams.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @param res A vector of strings. Output sentences.
+/// @details The i-th sentence is sampled using the i-th stream of a Philox
+/// generator keyed by 'seed', so that the output only depends on 'seed', and
+/// not on the number of threads or on the scheduling of threads.
+void Sampler::sentences (size_t n, 
+                         size_t max_length, 
+                         uint64_t seed,
+                         size_t n_threads,
+                         std::vector<std::string> & res) const
+{
+        res.assign(n, "");
+        parallel_chunks(n, n_threads, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                        Philox unif(seed, i);
+                        res[i] = sentence(unif, max_length);
+                }
+        });
+}
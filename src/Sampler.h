@@ -0,0 +1,212 @@
+/// @file   Sampler.h
+/// @brief  Definition of Sampler class
+/// @author Valerio Gherardi
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "Smoothing.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+/// @class Sampler
+/// @brief Sample words from the continuation probabilities of a Smoother,
+/// tempered as Prob(w|c) ^ (1 / T).
+/// @details Continuation probabilities are decomposed as described in
+/// Smoother::sparse_distribution():
+///
+///      Prob(w|c) = Prob(w|c) for w in F(c), Gamma(c) * Base(w) otherwise.
+///
+/// Tempered base distributions are precomputed at construction, so that
+/// sampling a word costs, on average, a number of operations proportional to
+/// the size of F(c) (typically, the number of words observed after the
+/// context), rather than to the size of the dictionary. The sampled
+/// distribution is exact: words are drawn from a mixture of F(c) and of the
+/// base distribution, which dominates the target distribution, and accepted
+/// with the appropriate rejection probability. As in previous versions, the
+/// Unknown-Word token is never sampled.
+///
+/// Optionally, sampling can be truncated to the 'top_k' most probable words
+/// and/or to the smallest set of most probable words whose (tempered)
+/// probability mass is at least 'top_p', see candidates().
+class Sampler {
+        /// @brief Tempered base distribution, see Sampler().
+        struct Base {
+                std::vector<double> prob; ///< @brief Base(w)
+                std::vector<double> weight; ///< @brief (Base(w) / max) ^ beta
+                std::vector<double> cdf; ///< @brief Cumulative weights
+                double max; ///< @brief Maximum of Base(w)
+                /// @brief Positions of words with non-zero weight, sorted by
+                /// decreasing weight (only for truncated sampling)
+                std::vector<size_t> ranks;
+        };
+
+        const Smoother & smoother_;
+        double beta_; ///< @brief Inverse temperature
+        size_t top_k_; ///< @brief Maximum number of candidates (0: no limit)
+        double top_p_; ///< @brief Probability mass of candidates
+        std::vector<Base> bases_; ///< @brief Indexed by Smoother::base_index()
+
+        /// @brief Tempered weight of a probability, relative to a maximum.
+        double temper (double p, double max) const
+                { return max > 0 ? std::pow(p / max, beta_) : 0; }
+public:
+        /// @brief Initialize sampler for a smoother and a temperature.
+        /// @param smoother A Smoother. Must outlive the Sampler, and must
+        /// not be modified while the Sampler is in use.
+        /// @param T A positive number. Sampling temperature.
+        /// @param top_k A non-negative integer. If positive, words are only
+        /// sampled among the 'top_k' most probable ones.
+        /// @param top_p A number between zero and one. If smaller than one, 
+        /// words are only sampled among the most probable ones, whose total 
+        /// probability is at least 'top_p'.
+        Sampler (const Smoother & smoother, 
+                 double T = 1.0, 
+                 size_t top_k = 0, 
+                 double top_p = 1.0); // Sampler.cpp
+
+        /// @brief Whether sampling is truncated, see candidates().
+        bool truncated () const { return top_k_ > 0 or top_p_ < 1; }
+
+        /// @brief Candidate words for truncated sampling, with their tempered
+        /// weights.
+        void candidates (const State & state, SparseProbs & res) const;
+                // Sampler.cpp
+
+        /// @brief Sample a word given a context state.
+        /// @param state A State. Context conditioning the probabilities.
+        /// @param unif A function object returning uniform random numbers in
+        /// the interval [0, 1).
+        /// @return ID of the sampled word. If all words have probability zero,
+        /// the End-Of-Sentence token is returned.
+        template<class Unif>
+        int sample (const State & state, Unif & unif) const
+        {
+                if (truncated())
+                        return sample_truncated(state, unif);
+                const Base & base = bases_[smoother_.base_index(state.order())];
+                SparseProbs probs;
+                double gamma;
+                smoother_.sparse_distribution(state, base.prob, probs, gamma);
+
+                // M: upper bound of the probabilities of all words but UNK
+                double max = gamma * base.max;
+                for (const auto & p : probs)
+                        if (p.first != UNK_ID)
+                                max = std::max(max, p.second);
+                if (max <= 0)
+                        return EOS_ID;
+                // Tempered weight of words not in F(c), relative to
+                // base.weight
+                double wb = temper(gamma * base.max, max);
+
+                // Target weights 'q' of words in F(c), and excess 'a' with
+                // respect to the base component of the proposal
+                size_t n = probs.size();
+                std::vector<double> q(n), a(n);
+                std::unordered_map<int, size_t> pos;
+                double SA = 0, SB = wb * base.cdf.back();
+                for (size_t j = 0; j < n; ++j) {
+                        pos[probs[j].first] = j;
+                        if (probs[j].first == UNK_ID)
+                                continue;
+                        size_t i = smoother_.dense_index(probs[j].first);
+                        q[j] = temper(probs[j].second, max);
+                        a[j] = std::max(q[j] - wb * base.weight[i], 0.);
+                        SA += a[j];
+                }
+                if (SA + SB <= 0)
+                        return EOS_ID;
+
+                while (true) {
+                        double u = unif() * (SA + SB);
+                        if (u < SA) { // Sample from excess weights of F(c)
+                                for (size_t j = 0; j < n; ++j) {
+                                        if (u < a[j])
+                                                return probs[j].first;
+                                        u -= a[j];
+                                }
+                                continue; // Rounding errors
+                        }
+                        // Sample from base distribution
+                        u = unif() * base.cdf.back();
+                        auto it = std::upper_bound(
+                                base.cdf.begin(), base.cdf.end(), u
+                                );
+                        if (it == base.cdf.end())
+                                continue; // Rounding errors
+                        size_t i = it - base.cdf.begin();
+                        int id = smoother_.dense_id(i);
+                        auto f = pos.find(id);
+                        if (f == pos.end())
+                                return id;
+                        size_t j = f->second;
+                        double proposal = a[j] + wb * base.weight[i];
+                        if (unif() * proposal < q[j])
+                                return id;
+                }
+        }
+
+        /// @brief Sample a word given a context state, among the candidates
+        /// of truncated sampling, see candidates().
+        /// @return ID of the sampled word. If there are no candidates, the 
+        /// End-Of-Sentence token is returned.
+        template<class Unif>
+        int sample_truncated (const State & state, Unif & unif) const
+        {
+                SparseProbs words;
+                candidates(state, words);
+                double total = 0;
+                for (const auto & w : words)
+                        total += w.second;
+                if (not (total > 0))
+                        return EOS_ID;
+                while (true) {
+                        double u = unif() * total;
+                        for (const auto & w : words) {
+                                if (u < w.second)
+                                        return w.first;
+                                u -= w.second;
+                        }
+                        // Rounding errors
+                }
+        }
+
+        /// @brief Sample a sentence, word by word, starting from the
+        /// Begin-Of-Sentence state.
+        /// @param unif A function object returning uniform random numbers in
+        /// the interval [0, 1).
+        /// @param max_length A positive integer. Maximum number of words.
+        /// @return The sampled words, followed by "<EOS>", or by a truncation
+        /// mark if no End-Of-Sentence token is sampled within 'max_length' 
+        /// words.
+        template<class Unif>
+        std::string sentence (Unif & unif, size_t max_length) const
+        {
+                std::string res = "";
+                State state = smoother_.initial_state();
+                size_t n_words = 0;
+                int new_word;
+                while (n_words < max_length) {
+                        n_words++;
+                        new_word = sample(state, unif);
+                        if (new_word == EOS_ID) 
+                                return res + "<EOS>";
+                        res += smoother_.word(new_word) + " ";
+                        smoother_.advance(state, new_word, state);
+                }
+                return res + "[...] (truncated output)";     
+        }
+
+        /// @brief Sample sentences in parallel, with reproducible random
+        /// streams.
+        void sentences (size_t n, 
+                        size_t max_length, 
+                        uint64_t seed,
+                        size_t n_threads,
+                        std::vector<std::string> & res) const; // Sampler.cpp
+}; // Sampler
+
+#endif // SAMPLER_H
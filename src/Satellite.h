@@ -1,9 +1,25 @@
 #ifndef SATELLITE_H
 #define SATELLITE_H
 
+class kgramFreqs;
+
+/// @class Satellite
+/// @brief Object derived from k-gram counts, updated by the kgramFreqs it is
+/// registered with, see kgramFreqs::add_satellite().
+/// @details A satellite removes itself from its kgramFreqs when destroyed. 
+/// A kgramFreqs destroyed first detaches its satellites, so that these never
+/// access a destroyed kgramFreqs (R does not guarantee the order in which 
+/// objects are finalized).
 class Satellite {
+        friend class kgramFreqs;
+        kgramFreqs * freqs_ = nullptr; ///< @brief Registration, if any
 public:
+        Satellite () = default;
+        /// @brief Copies are not registered.
+        Satellite (const Satellite &) {}
+        Satellite & operator= (const Satellite &) { return *this; }
+        virtual ~Satellite (); // kgramFreqs.cpp
         virtual void update () { return; }
 };
 
-#endif // SATELLITE_H
\ No newline at end of file
+#endif // SATELLITE_H
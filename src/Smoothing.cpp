@@ -1,5 +1,10 @@
 #include "Smoothing.h"
+#include "Parallel.h"
 #include <cmath>
+#include <thread>
+#include <algorithm>
+#include <unordered_set>
+#include <iterator>
 
 using std::pair;
 
@@ -14,151 +19,1070 @@ void Smoother::set_N (size_t N)
                 " k-gram frequency table."
         );
         N_ = N;
-        // Initialize prefix for begin of sentences
-        padding_ = "";
-        for (size_t k = 0; k < N_ - 1; ++k) {
-                padding_ += BOS_TOK + " ";
-        }
-}
-
-/// @brief truncate 'context' to last k - 1 words.
-std::string Smoother::truncate (std::string context, size_t k) const {
-        if (k == 1) return "";
-        size_t n_words = 0;
-        size_t start = std::string::npos;
-        while (n_words < k - 1) {
-                start = context.find_last_not_of(" ", start);
-                if (start == std::string::npos or start == 0) 
-                        return context;
-                start = context.find_last_of(" ", start);
-                if (start == std::string::npos or start == 0) 
-                        return context;
-                ++n_words;
+        params_changed();
+        // Initialize state for begin of sentences
+        bos_.keys = std::vector<std::string>(1, "");
+        for (size_t k = 1; k < N_; ++k) 
+                bos_.keys.push_back(join(bos_.keys.back(), BOS_IND));
+}
+
+/// @brief State of a context, truncated to its last N - 1 words.
+/// @param context A string. Context, where anything delimited by one or more
+/// spaces is considered a word.
+/// @return A State. Words not found in the dictionary are replaced by the
+/// Unknown-Word token.
+State Smoother::state (const std::string & context) const {
+        // Retrieve IDs of the words in context 
+        std::vector<int> ids;
+        WordStream stream(context);
+        std::string word;
+        while (true) {
+                word = stream.pop_word();
+                if (stream.eos()) 
+                        break;
+                ids.push_back(f_.id(word));
         }
-        return context.substr(start);
+        return state(ids);
 }
 
-/// @brief Return sentence probability and number of words in sentence 
-/// (useful for computing cross-entropies and perplexities)
-/// @param sentence A string. Sentence of which the probability is to be
-/// computed.
-/// @param log true or false. If true, returns log-probability, otherwise 
-/// probability.
-/// @return a positive number. Continuation probability of a word.
-/// @details Sentences are automatically padded (i.e. no need to include BOS and
-/// EOS tokens). In any case, any additional BOS and EOS tokens appearing in the
-/// word are automatically ignored.
-std::pair<double, size_t> Smoother::operator() (
-                const std::string & sentence, bool log
-        ) 
+/// @brief State of a context of word IDs, truncated to its last N - 1 words.
+/// @param ids A vector of integers. IDs of the words in context, which must 
+/// be valid IDs (i.e. EOS_ID, BOS_ID, UNK_ID or dictionary words).
+/// @return A State.
+State Smoother::state (const std::vector<int> & ids) const {
+        size_t start = ids.size() > N_ - 1 ? ids.size() - (N_ - 1) : 0;
+        State res;
+        res.keys = std::vector<std::string>(1, "");
+        for (size_t i = ids.size(); i > start; --i) {
+                std::string code = std::to_string(ids[i - 1]);
+                res.keys.push_back(
+                        res.keys.back().empty() ? 
+                                code : code + " " + res.keys.back()
+                        );
+        }
+        return res;
+}
+
+/// @brief Append a word to a context state.
+/// @param in A State. The initial state.
+/// @param word An integer. ID of the word to be appended to the context.
+/// @param out A State. The final state, can be the same object as 'in'.
+/// @details The context is kept truncated to its last N - 1 words. 
+void Smoother::advance (const State & in, int word, State & out) const {
+        size_t order = std::min(in.order() + 1, N_ - 1);
+        std::string code = std::to_string(word);
+        out.keys.resize(order + 1);
+        out.weights.reset();
+        // Proceed backwards, so that 'in' and 'out' can be the same object
+        for (size_t k = order; k > 1; --k) 
+                out.keys[k] = in.keys[k - 1] + " " + code;
+        if (order > 0) 
+                out.keys[1] = code;
+        out.keys[0] = "";
+}
+
+/// @brief Highest order of k-grams ending at a word with a non-zero count.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context preceding 'word'.
+/// @return A non-negative integer, at most state.order() + 1. A value of zero
+/// means that 'word' was never seen in training, so that smoothers fall back
+/// to the base case 1 / (V + 2).
+/// @details The result depends only on the k-gram counts, and not on the
+/// smoothing technique.
+size_t Smoother::hit_order (int word, const State & state) const {
+        KgramCodes codes(state, word);
+        for (size_t k = state.order() + 1; k > 0; --k)
+                if (f_.query(k, codes[k - 1]) > 0)
+                        return k;
+        return 0;
+}
+
+/// @brief Return continuation probability of a word given a context state.
+/// @param word A string. Word for which the continuation probability 
+/// is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @return a positive number, or -1 if the probability is not defined 
+/// (e.g. for the BOS token).
+double Smoother::operator() (const std::string & word, const State & state) 
 const {
-        std::string context = padding_, word;
+        WordStream ws(word);
+        std::string w = ws.pop_word();
+        if (ws.eos()) // 'word' consists of white space only
+                return -1;
+        // This will call the correct method when implemented by actual 
+        // smoothers
+        return prob(f_.id(w), state);
+}
+
+/// @brief Return continuation probabilities of a word given a context state,
+/// for models of all orders up to N.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of doubles. Output probabilities: res[k] is the 
+/// probability given by a model of order k + 1.
+/// @details Generic definition, calling prob() on each suffix of the context.
+void Smoother::prob_orders (int word, 
+                            const State & state, 
+                            std::vector<double> & res) const 
+{
+        size_t m = state.order();
+        res.resize(m + 1);
+        State suffix;
+        for (size_t order = 0; order <= m; ++order) {
+                suffix.keys.assign(state.keys.begin(), 
+                                   state.keys.begin() + order + 1);
+                res[order] = prob(word, suffix);
+        }
+}
+
+/// @brief Return continuation probabilities of all words given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, indexed as described
+/// in dense_index().
+void Smoother::distribution (const State & state, std::vector<double> & res)
+const {
+        res.resize(V() + 2);
+        for (size_t i = 0; i < V() + 2; ++i)
+                res[i] = prob(dense_id(i), state);
+}
+
+/// @brief Decompose the distribution of words given a context state, see
+/// base_distribution().
+/// @param state A State. Context conditioning the probabilities.
+/// @param base A vector of doubles. Base distribution for the order of 'state'.
+/// @param probs A list of (word ID, probability) pairs. Output probabilities 
+/// of the words in F(c), here all words.
+/// @param gamma A double. Output backoff factor Gamma(c), here zero.
+void Smoother::sparse_distribution (const State & state, 
+                                    const std::vector<double> & base,
+                                    SparseProbs & probs,
+                                    double & gamma) 
+const {
+        std::vector<double> dist;
+        distribution(state, dist);
+        probs.clear();
+        for (size_t i = 0; i < dist.size(); ++i)
+                probs.emplace_back(dense_id(i), dist[i]);
+        gamma = 0;
+}
+
+/// @brief Clear cached quantities if k-gram counts or parameters changed
+/// since they were computed. Must be called with cache_mutex_ locked.
+void Smoother::sync_cache () const
+{
+        if (cache_f_version_ == f_.version() and cache_version_ == version_) 
+                return;
+        rankings_.clear();
+        cache_.clear();
+        cache_f_version_ = f_.version();
+        cache_version_ = version_;
+}
+
+/// @brief Resolve the context dependent terms of a state.
+/// @param state A State. Its 'weights' are set to the context dependent 
+/// terms of all suffixes of the context, see context_weights().
+void Smoother::resolve (State & state) const 
+{
+        auto weights = std::make_shared<std::vector<ContextWeights>>();
+        for (size_t k = 0; k <= state.order(); ++k)
+                weights->push_back(context_weights(k, state));
+        state.weights = weights;
+}
+
+/// @brief State of a context, with resolved context dependent terms.
+/// @param context A string. Context, as in state().
+/// @return A State, whose 'weights' hold the context dependent terms of all
+/// suffixes of the context, see context_weights(). 
+/// @details If the context cache is enabled (see set_cache_capacity()), 
+/// states are retrieved from the cache when available, and stored in the 
+/// cache otherwise. The cache is cleared when new k-gram counts are 
+/// processed or parameters change. 
+State Smoother::context (const std::string & context) const 
+{
+        State res;
+        if (cache_.capacity() > 0) {
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                sync_cache();
+        }
+        if (cache_.get(context, res))
+                return res;
+        res = state(context);
+        resolve(res);
+        cache_.put(context, res);
+        return res;
+}
+
+/// @brief Ranking of words for contexts of a given order. 
+/// @param order A positive integer. Order of the context.
+/// @return A pointer to a Ranking, holding the base distribution of contexts
+/// of order 'order' and the IDs of all words but UNK, sorted by decreasing 
+/// base probability (ties being broken by position in dense vectors).
+/// @details Rankings are shared by orders with the same base_index(), and 
+/// computed on first use. The cache is cleared when new k-gram counts are 
+/// processed or parameters change. 
+std::shared_ptr<const Smoother::Ranking> 
+Smoother::ranking (size_t order) const 
+{
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        sync_cache();
+        size_t index = base_index(order);
+        if (index >= rankings_.size())
+                rankings_.resize(index + 1);
+        if (rankings_[index])
+                return rankings_[index];
+        
+        auto r = std::make_shared<Ranking>();
+        base_distribution(order, r->base);
+        for (size_t i = 0; i <= V(); ++i)
+                r->ids.push_back(dense_id(i));
+        const std::vector<double> & base = r->base;
+        std::stable_sort(r->ids.begin(), r->ids.end(), [&](int x, int y) {
+                return base[dense_index(x)] > base[dense_index(y)];
+        });
+        rankings_[index] = r;
+        return r;
+}
+
+/// @brief Most probable words given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param k A positive integer. Maximum number of words to return.
+/// @param res A list of (word ID, probability) pairs. Output words, sorted by
+/// decreasing probability.
+/// @details Words are searched among the ones in F(c) (see 
+/// sparse_distribution()) and then in order of decreasing base probability. 
+/// The search stops as soon as the bound Gamma(c) * Base(w) falls below the 
+/// k-th best probability found so far, so that typically only O(|F(c)| + k) 
+/// words are examined. The Unknown-Word token and words with zero 
+/// probability are never returned.
+void Smoother::top_k (const State & state, size_t k, SparseProbs & res) const
+{
+        auto better = [this](const std::pair<int, double> & x, 
+                             const std::pair<int, double> & y) {
+                if (x.second != y.second) 
+                        return x.second > y.second;
+                return dense_index(x.first) < dense_index(y.first);
+        };
+        res.clear();
+        if (k == 0) 
+                return;
+        auto r = ranking(state.order());
+        SparseProbs probs;
+        double gamma;
+        sparse_distribution(state, r->base, probs, gamma);
+        
+        // Words in F(c)
+        std::unordered_set<int> in_F;
+        for (const auto & p : probs) {
+                in_F.insert(p.first);
+                if (p.first != UNK_ID and p.second > 0) 
+                        res.push_back(p);
+        }
+        size_t n = std::min(k, res.size());
+        std::partial_sort(res.begin(), res.begin() + n, res.end(), better);
+        res.resize(n);
+        
+        // Other words, in order of decreasing upper bound Gamma(c) * Base(w)
+        for (int id : r->ids) {
+                std::pair<int, double> p(id, gamma * r->base[dense_index(id)]);
+                if (p.second <= 0 or 
+                    (res.size() == k and not better(p, res.back())))
+                        break;
+                if (in_F.count(id))
+                        continue;
+                res.insert(std::upper_bound(res.begin(), res.end(), p, better), 
+                           p);
+                if (res.size() > k)
+                        res.pop_back();
+        }
+}
+
+/// @brief Call fun(id, state) for each word of a sentence, where 'state' is
+/// the context state of the word with ID 'id'.
+/// @param smoother A smoother, of (static) type S.
+/// @param sentence A string. Sentence to be scored.
+/// @return The number of words in the sentence, including the End-Of-Sentence
+/// token.
+/// @details Sentences are padded as in Smoother::operator(). 
+template<class S, class Function>
+size_t for_each_token (const S & smoother, 
+                       const std::string & sentence, 
+                       Function fun) 
+{
+        State state = smoother.initial_state();
+        std::string word;
         WordStream ws(sentence);
         
-        // Use log-prob for safety (avoid numerical underflow)
-        double log_prob = 0.; size_t n_words = 1; // EOS; 
-        size_t pos; 
+        size_t n_words = 1; // EOS; 
         while((word = ws.pop_word()) != EOS_TOK) {
                 // Ignore eventual BOS tokens explicitly included in the user's
                 // input.
                 if (word == BOS_TOK) continue;
                 ++n_words;
-                // This will call the correct method when implemented by
-                // actual smoothers
-                log_prob += std::log(this->operator()(word, context));
-                // Update context: remove first word and append last
-                if (N() > 2) {
-                        pos = context.find_first_not_of(" ");
-                        pos = context.find_first_of(" ", pos);
-                        context = context.substr(pos) + " " + word;
-                } else if (N() == 2) {
-                        context = word;
-                }
+                // Score word and update context state
+                int id = smoother.id(word);
+                fun(id, state);
+                smoother.advance(state, id, state);
         }
         
         // Add final EOS token. This is not automatically in the loop to handle
         // the case where the user explicitly includes a final EOS token,
         // in which case the iteration breaks.
-        log_prob += std::log(this->operator()(EOS_TOK, context));
+        fun(EOS_ID, state);
         
-        return pair<double, size_t>
-                {log ? log_prob : std::exp(log_prob), n_words};
+        return n_words;
 }
 
-//--------//----------------SBOSmoother----------------//--------//
+/// @brief Log-probability and number of words of a sentence.
+/// @param smoother A smoother, of (static) type S.
+/// @param sentence A string. Sentence of which the probability is to be
+/// computed.
+/// @param profile Either nullptr, or a pointer to a HitProfile, in which 
+/// the words of the sentence are registered.
+/// @return A pair, whose first element is the sentence log-probability, and 
+/// the second one the number of words in the sentence, including the 
+/// End-Of-Sentence token.
+/// @details See Smoother::operator().
+template<class S>
+std::pair<double, size_t> sentence_log_prob (const S & smoother, 
+                                             const std::string & sentence,
+                                             HitProfile * profile) 
+{
+        // Use log-prob for safety (avoid numerical underflow)
+        double log_prob = 0.;
+        size_t n_words = for_each_token(smoother, sentence, 
+                [&](int id, const State & state) {
+                        log_prob += std::log(smoother.prob(id, state));
+                        if (profile) profile->add(smoother, id, state);
+                });
+        return std::pair<double, size_t>{log_prob, n_words};
+}
+
+/// @brief Compute log-probabilities and word counts of a batch of sentences.
+/// @param smoother A smoother, of (static) type S.
+/// @param sentences A vector of strings. Sentences to be scored, treated as in
+/// Smoother::operator()(const std::string &, bool).
+/// @param log_prob A vector of doubles. Output sentence log-probabilities.
+/// @param n_words A vector of positive integers. Output word counts.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @param profile Either nullptr, or a pointer to a HitProfile, in which 
+/// the words of all sentences are registered.
+/// @details The batch is split into contiguous chunks, each scored by a 
+/// separate thread, which only reads from the (constant) model and writes 
+/// to its own slice of the output. Results are thus identical for any number
+/// of threads.
+template<class S>
+void score_batch (const S & smoother,
+                  const std::vector<std::string> & sentences,
+                  std::vector<double> & log_prob,
+                  std::vector<size_t> & n_words,
+                  size_t n_threads,
+                  HitProfile * profile) 
+{
+        size_t len = sentences.size();
+        log_prob.resize(len);
+        n_words.resize(len);
+        
+        std::mutex profile_mutex;
+        parallel_chunks(len, n_threads, [&](size_t begin, size_t end) {
+                HitProfile local(smoother.N());
+                HitProfile * p = profile ? &local : nullptr;
+                for (size_t i = begin; i < end; ++i) {
+                        pair<double, size_t> res = 
+                                sentence_log_prob(smoother, sentences[i], p);
+                        log_prob[i] = res.first;
+                        n_words[i] = res.second;
+                }
+                if (profile) {
+                        std::lock_guard<std::mutex> lock(profile_mutex);
+                        profile->merge(local);
+                }
+        });
+}
 
-/// @brief Remove first word from context
-void Smoother::backoff (std::string & context) const 
+/// @brief Compute log-probabilities and word counts of a batch of sentences,
+/// for models of all orders up to N.
+/// @param smoother A smoother, of (static) type S.
+/// @param sentences A vector of strings. Sentences to be scored, treated as in
+/// Smoother::operator()(const std::string &, bool).
+/// @param log_prob A vector of doubles. Output sentence log-probabilities: 
+/// log_prob[i * N + k] is the log-probability of the i-th sentence, according
+/// to a model of order k + 1.
+/// @param n_words A vector of positive integers. Output word counts.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @param profile Either nullptr, or a pointer to a HitProfile, in which 
+/// the words of all sentences are registered (for the model of order N).
+/// @details Each sentence is scored in a single pass, see 
+/// Smoother::prob_orders(). Results for the order N coincide with the ones
+/// of score_batch().
+template<class S>
+void score_batch_orders (const S & smoother,
+                         const std::vector<std::string> & sentences,
+                         std::vector<double> & log_prob,
+                         std::vector<size_t> & n_words,
+                         size_t n_threads,
+                         HitProfile * profile) 
 {
-        size_t pos = context.find_first_not_of(" ");
-        pos = context.find_first_of(" ", pos);
-        if (pos == std::string::npos or 
-                    context.find_first_not_of(" ", pos) == std::string::npos) 
-                context.erase();
-        else
-                context = context.substr(pos);
+        size_t len = sentences.size(), N = smoother.N();
+        log_prob.assign(len * N, 0.);
+        n_words.resize(len);
+        
+        std::mutex profile_mutex;
+        parallel_chunks(len, n_threads, [&](size_t begin, size_t end) {
+                std::vector<double> probs;
+                HitProfile local(N);
+                for (size_t i = begin; i < end; ++i) {
+                        double * lp = &log_prob[i * N];
+                        n_words[i] = for_each_token(smoother, sentences[i], 
+                                [&](int id, const State & state) {
+                                        smoother.prob_orders(id, state, probs);
+                                        for (size_t k = 0; k < N; ++k)
+                                                lp[k] += std::log(probs[k]);
+                                        if (profile) 
+                                                local.add(smoother, id, state);
+                                });
+                }
+                if (profile) {
+                        std::lock_guard<std::mutex> lock(profile_mutex);
+                        profile->merge(local);
+                }
+        });
+}
+
+/// @brief Compute the total log-probability of a batch of sentences, for
+/// each point of a grid of discounts.
+/// @param smoother A smoother, of (static) type S, with S::n_discounts 
+/// discount parameters.
+/// @param sentences A vector of strings. Sentences to be scored, treated as in
+/// Smoother::operator()(const std::string &, bool).
+/// @param grid A vector of vectors of doubles. Each element contains the
+/// S::n_discounts discounts of a grid point, in the order of the 
+/// smoother's constructor.
+/// @param log_prob A vector of doubles. Output total log-probabilities, one
+/// per grid point.
+/// @param n_words A positive integer. Output total word count.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @details Sentences are tokenized, and the counts entering the probability
+/// of each word (see DiscountStats) looked up, only once for the whole grid.
+/// Probabilities at each grid point are then computed from these counts alone,
+/// and coincide with the ones obtained by setting the discounts of the 
+/// smoother. Grid points are split among threads.
+template<class S>
+void score_discount_grid (const S & smoother,
+                          const std::vector<std::string> & sentences,
+                          const std::vector<std::vector<double>> & grid,
+                          std::vector<double> & log_prob,
+                          size_t & n_words,
+                          size_t n_threads) 
+{
+        for (const auto & D : grid)
+                if (D.size() != S::n_discounts)
+                        throw std::invalid_argument(
+                                "Wrong number of discount parameters."
+                        );
+        
+        // Statistics of all words are stored contiguously; those of the i-th 
+        // word are stats[offset[i]], ..., stats[offset[i + 1] - 1]. The words
+        // of the j-th sentence are those with last[j - 1] <= i < last[j].
+        std::vector<DiscountStats> stats, word_stats;
+        std::vector<size_t> offset{0}, last;
+        last.reserve(sentences.size());
+        n_words = 0;
+        for (const std::string & sentence : sentences) {
+                n_words += for_each_token(smoother, sentence, 
+                        [&](int id, const State & state) {
+                                smoother.discount_stats(id, state, word_stats);
+                                stats.insert(stats.end(), 
+                                             word_stats.begin(), 
+                                             word_stats.end());
+                                offset.push_back(stats.size());
+                        });
+                last.push_back(offset.size() - 1);
+        }
+        
+        size_t len = grid.size();
+        log_prob.assign(len, 0.);
+        parallel_chunks(len, n_threads, [&](size_t begin, size_t end) {
+                for (size_t g = begin; g < end; ++g) {
+                        const double * D = grid[g].data();
+                        // Sum as in sentence_log_prob() within sentences, 
+                        // and with extended precision over sentences (as 
+                        // R's sum()), so that results coincide exactly with 
+                        // the ones of perplexity().
+                        long double lp = 0.;
+                        size_t i = 0;
+                        for (size_t j : last) {
+                                double sentence_lp = 0.;
+                                for (; i < j; ++i) 
+                                        sentence_lp += std::log(
+                                                smoother.discounted_prob(
+                                                        &stats[offset[i]], 
+                                                        offset[i + 1] - 
+                                                                offset[i],
+                                                        D
+                                                ));
+                                lp += sentence_lp;
+                        }
+                        log_prob[g] = lp;
+                }
+        });
 }
 
+/// @brief Compute the total log-probability and word count of the text read
+/// from a stream.
+/// @param smoother A smoother, of (static) type S.
+/// @param in An input stream. Text is read line by line, until the end of the
+/// stream.
+/// @param process A TextProcessor. Preprocessing and sentence tokenization
+/// applied to each line.
+/// @param n_words A positive integer. Output total word count.
+/// @param batch_size A positive integer. Number of lines processed at a time.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @param details Either nullptr, or a pointer to a SentenceScores object, to 
+/// which the scores of individual sentences are appended.
+/// @param profile Either nullptr, or a pointer to a HitProfile, in which 
+/// the words of all sentences are registered.
+/// @return The total log-probability of sentences.
+/// @details Each batch of lines is split into contiguous chunks, which are 
+/// processed, tokenized and scored by separate threads, while the next batch
+/// is read from the stream. Results are then reduced in the order of 
+/// sentences, with an extended precision accumulator (as R's sum()), so that 
+/// these do not depend on the batch size and number of threads, and coincide
+/// with the ones obtained by scoring the tokenized text as a whole.
+template<class S>
+double score_stream (const S & smoother, 
+                     std::istream & in,
+                     const TextProcessor & process,
+                     size_t & n_words,
+                     size_t batch_size,
+                     size_t n_threads,
+                     SentenceScores * details,
+                     HitProfile * profile) 
+{
+        auto read_batch = [&in, batch_size](std::vector<std::string> & lines) {
+                lines.clear();
+                std::string line;
+                while (lines.size() < batch_size and std::getline(in, line)) {
+                        if (not line.empty() and line.back() == '\r')
+                                line.pop_back();
+                        lines.push_back(std::move(line));
+                }
+        };
+        
+        std::vector<std::string> lines, next;
+        n_threads = std::max(n_threads, (size_t)1);
+        std::vector<SentenceScores> chunks(n_threads);
+        std::vector<HitProfile> profiles(n_threads, HitProfile(smoother.N()));
+        long double log_prob = 0.;
+        n_words = 0;
+        
+        read_batch(lines);
+        while (not lines.empty()) {
+                std::exception_ptr read_error;
+                std::thread reader([&read_batch, &next, &read_error]() {
+                        try {
+                                read_batch(next);
+                        } catch (...) {
+                                read_error = std::current_exception();
+                        }
+                });
+                // Join the reader also if scoring throws
+                struct Joiner { 
+                        std::thread & t; 
+                        ~Joiner () { if (t.joinable()) t.join(); }
+                } joiner{reader};
+                
+                // One chunk of lines per thread
+                size_t len = lines.size(), n_chunks = std::min(n_threads, len);
+                parallel_chunks(n_chunks, n_chunks, [&](size_t c, size_t) {
+                        SentenceScores & res = chunks[c];
+                        HitProfile * p = profile ? &profiles[c] : nullptr;
+                        res.sentence.clear();
+                        res.log_prob.clear();
+                        res.n_words.clear();
+                        size_t end = (c + 1) * len / n_chunks;
+                        for (size_t i = c * len / n_chunks; i < end; ++i) 
+                                process(lines[i], res.sentence);
+                        for (const std::string & sentence : res.sentence) {
+                                pair<double, size_t> lp = sentence_log_prob(
+                                        smoother, sentence, p
+                                        );
+                                res.log_prob.push_back(lp.first);
+                                res.n_words.push_back(lp.second);
+                        }
+                });
+                reader.join();
+                if (read_error) 
+                        std::rethrow_exception(read_error);
+                
+                for (size_t c = 0; c < n_chunks; ++c) {
+                        SentenceScores & res = chunks[c];
+                        for (size_t j = 0; j < res.log_prob.size(); ++j) {
+                                log_prob += res.log_prob[j];
+                                n_words += res.n_words[j];
+                        }
+                        if (details == nullptr) 
+                                continue;
+                        std::move(res.sentence.begin(), res.sentence.end(),
+                                  std::back_inserter(details->sentence));
+                        details->log_prob.insert(details->log_prob.end(),
+                                                 res.log_prob.begin(),
+                                                 res.log_prob.end());
+                        details->n_words.insert(details->n_words.end(),
+                                                res.n_words.begin(),
+                                                res.n_words.end());
+                }
+                std::swap(lines, next);
+        }
+        
+        if (profile) 
+                for (const HitProfile & p : profiles)
+                        profile->merge(p);
+        return log_prob;
+}
+
+/// @brief Compute the total log-probability and word count of an encoded 
+/// corpus.
+/// @param smoother A smoother, of (static) type S.
+/// @param corpus An EncodedCorpus. Sentences to be scored.
+/// @param n_words A positive integer. Output total word count.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @param details Either nullptr, or a pointer to a SentenceScores object, to 
+/// which the scores of individual sentences are appended. Sentences are 
+/// decoded from the corpus, with words encoded as Unknown-Word tokens 
+/// replaced by UNK_TOK, and include any words following an explicit 
+/// End-Of-Sentence token (which are not scored).
+/// @param profile Either nullptr, or a pointer to a HitProfile, in which 
+/// the words of all sentences are registered.
+/// @return The total log-probability of sentences.
+/// @details Word codes of the corpus are converted to word IDs of the model
+/// once, so that no tokenization or dictionary lookup is performed while 
+/// scoring. The token stream is split at sentence boundaries into contiguous
+/// chunks, each scored by a separate thread, and results are reduced as in 
+/// score_stream(). These coincide with the ones obtained by scoring the 
+/// original sentences with sentence_log_prob().
+template<class S>
+double score_encoded (const S & smoother, 
+                      const EncodedCorpus & corpus,
+                      size_t & n_words,
+                      size_t n_threads,
+                      SentenceScores * details,
+                      HitProfile * profile) 
+{
+        using namespace corpus_format;
+        std::vector<int> ids(corpus.n_codes());
+        ids[EOS_CODE] = ids[EOS_TOKEN_CODE] = EOS_ID;
+        ids[UNK_CODE] = UNK_ID;
+        ids[BOS_TOKEN_CODE] = BOS_ID;
+        for (size_t code = WORD_CODE; code < ids.size(); ++code)
+                ids[code] = smoother.id(corpus.word(code));
+        auto token = [&corpus](uint32_t code) -> const std::string & {
+                switch (code) {
+                case UNK_CODE: return UNK_TOK;
+                case BOS_TOKEN_CODE: return BOS_TOK;
+                case EOS_TOKEN_CODE: return EOS_TOK;
+                default: return corpus.word(code);
+                }
+        };
+        
+        n_threads = std::max(n_threads, (size_t)1);
+        std::vector<size_t> bounds = corpus.boundaries(n_threads);
+        std::vector<SentenceScores> chunks(n_threads);
+        std::vector<HitProfile> profiles(n_threads, HitProfile(smoother.N()));
+        parallel_chunks(n_threads, n_threads, [&](size_t c, size_t) {
+                SentenceScores & res = chunks[c];
+                HitProfile * p = profile ? &profiles[c] : nullptr;
+                EncodedCorpus::Cursor cursor = 
+                        corpus.cursor(bounds[c], bounds[c + 1]);
+                State state = smoother.initial_state();
+                std::string sentence;
+                double log_prob = 0.;
+                size_t n = 1; // EOS
+                // Whether the sentence was ended by an explicit EOS_TOK, 
+                // after which words are ignored, as in for_each_token().
+                bool ended = false; 
+                uint32_t code;
+                while (cursor.next(code)) {
+                        if (code != EOS_CODE) {
+                                if (details) {
+                                        if (not sentence.empty()) 
+                                                sentence += ' ';
+                                        sentence += token(code);
+                                }
+                                if (ended or code == BOS_TOKEN_CODE)
+                                        continue;
+                        }
+                        int id = ids[code];
+                        if (not ended) {
+                                log_prob += std::log(smoother.prob(id, state));
+                                if (p) p->add(smoother, id, state);
+                        }
+                        if (code == EOS_TOKEN_CODE) {
+                                ended = true;
+                                continue;
+                        }
+                        if (code == EOS_CODE) {
+                                res.log_prob.push_back(log_prob);
+                                res.n_words.push_back(n);
+                                if (details) 
+                                        res.sentence.push_back(sentence);
+                                state = smoother.initial_state();
+                                sentence.clear();
+                                log_prob = 0.;
+                                n = 1;
+                                ended = false;
+                                continue;
+                        }
+                        smoother.advance(state, id, state);
+                        ++n;
+                }
+        });
+        
+        long double log_prob = 0.;
+        n_words = 0;
+        for (SentenceScores & res : chunks) {
+                for (size_t j = 0; j < res.log_prob.size(); ++j) {
+                        log_prob += res.log_prob[j];
+                        n_words += res.n_words[j];
+                }
+                if (details == nullptr) 
+                        continue;
+                std::move(res.sentence.begin(), res.sentence.end(),
+                          std::back_inserter(details->sentence));
+                details->log_prob.insert(details->log_prob.end(),
+                                         res.log_prob.begin(),
+                                         res.log_prob.end());
+                details->n_words.insert(details->n_words.end(),
+                                        res.n_words.begin(),
+                                        res.n_words.end());
+        }
+        if (profile) 
+                for (const HitProfile & p : profiles)
+                        profile->merge(p);
+        return log_prob;
+}
+
+/// @brief Return sentence probability and number of words in sentence 
+/// (useful for computing cross-entropies and perplexities)
+/// @param sentence A string. Sentence of which the probability is to be
+/// computed.
+/// @param log true or false. If true, returns log-probability, otherwise 
+/// probability.
+/// @return a positive number. Continuation probability of a word.
+/// @details Sentences are automatically padded (i.e. no need to include BOS and
+/// EOS tokens). In any case, any additional BOS and EOS tokens appearing in the
+/// word are automatically ignored.
+std::pair<double, size_t> Smoother::operator() (
+                const std::string & sentence, bool log
+        ) 
+const {
+        pair<double, size_t> res = sentence_log_prob(*this, sentence);
+        return pair<double, size_t>
+                {log ? res.first : std::exp(res.first), res.second};
+}
+
+/// @brief Compute log-probabilities and word counts of a batch of sentences.
+/// @param sentences A vector of strings. Sentences to be scored, treated as in
+/// operator()(const std::string &, bool).
+/// @param log_prob A vector of doubles. Output sentence log-probabilities.
+/// @param n_words A vector of positive integers. Output word counts.
+/// @param n_threads A positive integer. Number of threads to be used.
+/// @details Probabilities are computed through virtual calls, see 
+/// score_batch() for the statically dispatched version.
+void Smoother::score_sentences (const std::vector<std::string> & sentences,
+                                std::vector<double> & log_prob,
+                                std::vector<size_t> & n_words,
+                                size_t n_threads
+) const {
+        score_batch(*this, sentences, log_prob, n_words, n_threads);
+}
+
+//--------//----------------SBOSmoother----------------//--------//
+
 /// @brief Return Stupid Backoff continuation score of a word given a 
 /// context.
-/// @param word A string. Word for which the continuation score 
+/// @param word An integer. ID of the word for which the continuation score 
 /// is to be computed.
-/// @param context A string. Context conditioning the score of 
-/// 'word'. Passed by value.
+/// @param state A State. Context conditioning the score of 'word'.
 /// @return a positive number. Stupid Backoff continuation score of
 /// 'word' given 'context'.
-double SBOSmoother::operator() (const std::string & word, std::string context) 
-const {
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+double SBOSmoother::prob (int word, const State & state) const 
+{
+        if (word == BOS_ID) 
                 return -1;
-        context = truncate(context, N_);
+        std::string code = std::to_string(word);
+        size_t k = state.order();
         double kgram_count, penalization = 1.;
-        while ((kgram_count = f_.query(context + " " + word)) == 0) {
-                backoff(context);
+        while ((kgram_count = f_.query(k + 1, join(state.keys[k], code))) == 0) 
+        {
+                if (k > 0) --k; // Backoff
                 penalization *= lambda_;
-                if (context == "" and f_.query(word) == 0)
+                if (k == 0 and f_.query(1, code) == 0) {
+                        if (instrumented) count_resolved(0);
                         return 1 / (double)(V() + 2);
+                }
+        }
+        if (instrumented) count_resolved(k + 1);
+        return penalization * kgram_count / weights(k, state).den;
+}
+
+/// @brief Context dependent terms of Stupid Backoff scores.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return 'den' is the count of the context suffix of order 'order'.
+ContextWeights SBOSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        return ContextWeights{f_.query(order, state.keys[order]), 1.};
+}
+
+/// @brief Return Stupid Backoff continuation scores of all words given a 
+/// context state.
+/// @param state A State. Context conditioning the scores.
+/// @param res A vector of doubles. Output scores, see dense_index().
+void SBOSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        // Negative values flag words not yet assigned at higher orders
+        res.assign(V() + 2, -1);
+        double penalization = 1.;
+        for (size_t k = state.order() + 1; k-- > 0; penalization *= lambda_) {
+                const std::string & context = state.keys[k];
+                double den = f_.query(k, context);
+                for_each_follower(k, context, 
+                        [&](int id, double count) {
+                        double & p = res[dense_index(id)];
+                        if (p < 0) 
+                                p = penalization * count / den;
+                });
+        }
+        for (double & p : res) 
+                if (p < 0) p = 1 / (double)(V() + 2);
+}
+
+/// @brief Base distribution of Stupid Backoff scores.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output scores, see dense_index().
+/// @details These are the scores of words not observed after the last word of
+/// a context of order 'order', i.e. the (penalized) 1-gram scores. 
+void SBOSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        res.assign(V() + 2, 1 / (double)(V() + 2));
+        double penalization = 1.;
+        for (size_t k = 0; k < order; ++k) 
+                penalization *= lambda_;
+        double den = f_.query(0, "");
+        for_each_follower(0, "", [&](int id, double count) {
+                res[dense_index(id)] = penalization * count / den;
+        });
+}
+
+/// @brief Decompose the distribution of Stupid Backoff scores given a 
+/// context state, see Smoother::sparse_distribution().
+/// @details F(c) contains the words observed after the last word of the 
+/// context. Penalizations are included in the base distribution, so that 
+/// Gamma(c) = 1.
+void SBOSmoother::sparse_distribution (const State & state, 
+                                       const std::vector<double> & base,
+                                       SparseProbs & probs,
+                                       double & gamma) 
+const {
+        gamma = 1.;
+        size_t m = state.order();
+        probs.clear();
+        if (m == 0) 
+                return;
+        std::unordered_map<int, size_t> pos;
+        init_sparse(1, state.keys[1], base, probs, pos);
+        // Negative values flag words not yet assigned at higher orders
+        for (auto & p : probs) 
+                p.second = -1;
+        double penalization = 1.;
+        for (size_t k = m; k > 0; --k, penalization *= lambda_) {
+                const std::string & context = state.keys[k];
+                double den = f_.query(k, context);
+                for_each_follower(k, context, [&](int id, double count) {
+                        double & p = probs[pos.at(id)].second;
+                        if (p < 0) 
+                                p = penalization * count / den;
+                });
         }
-        return penalization * kgram_count / f_.query(context);
 }
 
 //--------//----------------AddkSmoother----------------//--------//
 
 /// @brief Return Add-k continuation probability of a word 
 /// given a context.
-/// @param word A string. Word for which the continuation probability 
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of 
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Add-k continuation probability of
 /// 'word' given 'context'.
-double AddkSmoother::operator() (const std::string & word, std::string context)
-const {
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+double AddkSmoother::prob (int word, const State & state) const 
+{
+        if (word == BOS_ID) 
                 return -1;
-        context = truncate(context, N_);
-        double num = f_.query(context + " " + word) + k_;
-        double den = f_.query(context) + k_ * (V() + 2);
-        return num / den;
+        size_t m = state.order();
+        const std::string & context = state.keys[m];
+        double count = f_.query(m + 1, join(context, std::to_string(word)));
+        if (instrumented) count_resolved(count > 0 ? m + 1 : 0);
+        double den = weights(m, state).den;
+        return (count + k_) / den;
+}
+
+/// @brief Context dependent terms of Add-k probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return 'den' is the denominator of probabilities in the context suffix 
+/// of order 'order', and 'gamma' the probability of unobserved words.
+ContextWeights AddkSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        double den = f_.query(order, state.keys[order]) + k_ * (V() + 2);
+        return ContextWeights{den, k_ / den};
+}
+
+/// @brief Return Add-k continuation probabilities of all words given a 
+/// context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+void AddkSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        size_t m = state.order();
+        const std::string & context = state.keys[m];
+        double den = f_.query(m, context) + k_ * (V() + 2);
+        res.assign(V() + 2, k_ / den);
+        for_each_follower(m, context, 
+                [&](int id, double count) {
+                res[dense_index(id)] = (count + k_) / den;
+        });
+}
+
+/// @brief Base distribution of Add-k probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details For order zero, this is the distribution for the empty context,
+/// and is uniform otherwise.
+void AddkSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        if (order == 0) 
+                distribution(State{std::vector<std::string>(1, "")}, res);
+        else 
+                res.assign(V() + 2, 1 / (double)(V() + 2));
+}
+
+/// @brief Decompose the distribution of Add-k probabilities given a 
+/// context state, see Smoother::sparse_distribution().
+/// @details F(c) contains the words observed after the context.
+void AddkSmoother::sparse_distribution (const State & state, 
+                                        const std::vector<double> & base,
+                                        SparseProbs & probs,
+                                        double & gamma) 
+const {
+        size_t m = state.order();
+        probs.clear();
+        if (m == 0) {
+                gamma = 1.;
+                return;
+        }
+        const std::string & context = state.keys[m];
+        double den = f_.query(m, context) + k_ * (V() + 2);
+        for_each_follower(m, context, [&](int id, double count) {
+                probs.emplace_back(id, (count + k_) / den);
+        });
+        gamma = k_ * (V() + 2) / den;
 }
 
 //--------//----------------MLSmoother----------------//--------//
 
 /// @brief Return Maximum-Likelihood continuation probability of a word 
 /// given a context.
-/// @param word A string. Word for which the continuation probability 
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of 
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Maximum-Likelihood continuation 
 /// probability of 'word' given 'context'.
-double MLSmoother::operator() (const std::string & word, std::string context)
-        const {
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+double MLSmoother::prob (int word, const State & state) const 
+{
+        if (word == BOS_ID) 
                 return -1;
-        context = truncate(context, N_);
-        double den = f_.query(context);
-        return den > 0 ? f_.query(context + " " + word) / den : -1;
+        size_t m = state.order();
+        const std::string & context = state.keys[m];
+        double den = weights(m, state).den;
+        if (den <= 0) {
+                if (instrumented) count_resolved(0);
+                return -1;
+        }
+        double count = f_.query(m + 1, join(context, std::to_string(word)));
+        if (instrumented) count_resolved(count > 0 ? m + 1 : 0);
+        return count / den;
+}
+
+/// @brief Context dependent terms of Maximum-Likelihood probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return 'den' is the count of the context suffix of order 'order'.
+ContextWeights MLSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        return ContextWeights{f_.query(order, state.keys[order]), 0.};
+}
+
+/// @brief Return Maximum-Likelihood continuation probabilities of all words 
+/// given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// These are all -1 (not defined) if the context was never observed.
+void MLSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        size_t m = state.order();
+        const std::string & context = state.keys[m];
+        double den = f_.query(m, context);
+        if (den == 0) {
+                res.assign(V() + 2, -1);
+                return;
+        }
+        res.assign(V() + 2, 0);
+        for_each_follower(m, context, 
+                [&](int id, double count) {
+                res[dense_index(id)] = count / den;
+        });
+}
+
+/// @brief Base distribution of Maximum-Likelihood probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details For order zero, this is the distribution for the empty context,
+/// and is uniform otherwise. Undefined distributions are replaced by uniform 
+/// ones.
+void MLSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        if (order == 0 and f_.query(0, "") > 0) 
+                distribution(State{std::vector<std::string>(1, "")}, res);
+        else 
+                res.assign(V() + 2, 1 / (double)(V() + 2));
+}
+
+/// @brief Decompose the distribution of Maximum-Likelihood probabilities given
+/// a context state, see Smoother::sparse_distribution().
+/// @details F(c) contains the words observed after the context, and 
+/// Gamma(c) = 0. If the context was never observed, the distribution is not 
+/// defined, and is replaced by the (uniform) base distribution.
+void MLSmoother::sparse_distribution (const State & state, 
+                                      const std::vector<double> & base,
+                                      SparseProbs & probs,
+                                      double & gamma) 
+const {
+        size_t m = state.order();
+        const std::string & context = state.keys[m];
+        double den = f_.query(m, context);
+        probs.clear();
+        if (m == 0 or den == 0) {
+                gamma = 1.;
+                return;
+        }
+        for_each_follower(m, context, [&](int id, double count) {
+                probs.emplace_back(id, count / den);
+        });
+        gamma = 0.;
 }
 
 //--------//----------------KNSmoother----------------//--------//
@@ -209,18 +1133,58 @@ void KNFreqs::update ()
                                 ];
                 }
         }
+        
+        // Index of left continuation counts by context, see l_followers()
+        indexed_ = f_.followers_index();
+        if (indexed_)
+                lf_.build(l_.tables());
+        else 
+                lf_.clear();
+}
+
+/// @brief update context counts of KNSmoother
+void KNWeights::update ()
+{
+        high_ = ContextTablesVec<Counts>(f_.N());
+        low_ = ContextTablesVec<Counts>(f_.N() - 1);
+        
+        // N1+(.) without considering <BOS>, used for the empty context
+        double N1p_empty = f_[1].size() - 1;
+        
+        // Contexts of the highest order term: den = Count(c), and
+        //      BackoffFac(c) = D * N1+(c,*) / Count(c)
+        for (size_t k = 0; k < f_.N(); ++k) {
+                for (const auto & p : f_[k]) {
+                        double den = p.second;
+                        if (den == 0) continue;
+                        double num = k > 0 ? 
+                                knf_.r().query(k, p.first) : N1p_empty;
+                        high_[k][p.first] = Counts{den, num};
+                }
+        }
+        
+        // Contexts of continuation terms: den = N1+(*,c,*), and
+        //      BackoffFac(c) = D * N1+(c,*) / N1+(*,c,*)
+        for (size_t k = 0; k < f_.N() - 1; ++k) {
+                for (const auto & p : knf_.lr()[k]) {
+                        double den = p.second;
+                        if (den == 0) continue;
+                        double num = k > 0 ? 
+                                knf_.r().query(k, p.first) : N1p_empty;
+                        low_[k][p.first] = Counts{den, num};
+                }
+        }
 }
 
 /// @brief Return Kneser-Ney continuation probability of a word
 /// given a context.
-/// @param word A string. Word for which the continuation probability
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Kneser-Ney continuation
 /// probability of 'word' given 'context'.
-double KNSmoother::operator() (const std::string & word, std::string context) 
-        const {
+double KNSmoother::prob (int word, const State & state) const 
+{
         // The probability of word 'w' in context 'c' is given by:
         //
         //      Prob(w|c) = ProbDisc(w|c) + BackoffFac(c) * ProbCont(w|c--)
@@ -233,102 +1197,253 @@ double KNSmoother::operator() (const std::string & word, std::string context)
         //      ProbCont(w|c--) = Continuation probability of 'w|c--' 
         //
         // Here N1+(c,*) = (# different words following context 'c') is the
-        // continuation count; []+ denotes positive part; the continuation 
-        // probability is defined below. For the base case, we replace
-        //      ProbCont(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
-        
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
-                return -1;
-        context = truncate(context, N_); // keep at most N - 1 words
-        double den = f_.query(context);
-        double num = f_.query(context + " " + word) - D_;
-        num = num > 0 ? num : 0;
-        
-        // Compute ProbDisc(w|c)
-        double prob_disc = den > 0 ? num / den : 0;
-        
-        // Handle separately the 1-gram probability case
-        if (context == "") {
-                num = f_[1].size() - 1; // N1+(.) without considering <BOS>
-                // Compute BackoffFac(c)
-                double backoff_fac = den > 0 ? D_ * num / den : 1; 
-                // Compute ProbCont(c) (this is potentially > than num!)
-                double prob_cont = 1 / (double)(V() + 2);
-                return prob_disc + backoff_fac * prob_cont;
-        }
-        
-        // Compute BackoffFac(c)
-        // overwrite num which is no longer necessary
-        auto p = f_.kgram_code(context); // this is a pair {order, code}
-        double backoff_fac = den != 0 ? 
-                D_ * knf_.r().query(p.first, p.second) / den : 1;
-        
-        // Backoff directly on the k-gram code (stored in p.second)
-        // overwrite 'context' with backed off context CODE
-        size_t pos = p.second.find_first_of(" ");
-        context = (pos != std::string::npos) ? p.second.substr(pos + 1) : "";
-        
-        // Compute continuation probability
-        std::string index_word = f_.index(word);
-        double prob_cont = this->prob_cont(index_word, context, p.first);
-        return prob_disc + backoff_fac * prob_cont;
-}
-
-
-// Compute continuation probability of word in a given context. 'order' is the
-// k-gram order of context, passed for efficiency.
-double KNSmoother::prob_cont (
-                const std::string & word, std::string context, size_t order
-) const {
-        // The continuation probability of word 'w' in context 'c' is given by:
+        // continuation count; []+ denotes positive part. The continuation 
+        // probability of word 'w' in context 'c' is in turn given by:
         //
         //      ProbCont(w|c) = ProbContDisc(w|c) + 
         //                              BackoffFac(c) * ProbCont(w|c--)
         //
-        // where c-- is the backed-off context (remove first word from 'c') and:
+        // where:
         //
         //      ProbContDisc(w|c) = [N1+(*,c,w)-D]+ / N1+(*,c,*)
         //      BackoffFac(c) = 1 - sum_w(ProbContDisc(w|c))
         //                    = D * N1+(c,*) / N1+(*,c,*)
-        //      ProbCont(w|c--) = Continuation probability of 'w|c--'
+        //
         // For the base case, we replace
         //      ProbCont(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
-        
-        // Compute denominator of ProbContDisc(w|c)
-        double den = knf_.lr().query(order - 1, context);
-        
-        // Compute numerator of ProbContDisc(w|c)
-        double num = knf_.l().query(
-                order, context != "" ? context + " " + word : word
-                ) - D_;
-        num = num > 0 ? num : 0;
+        // where V is the number of words in the dictionary (without <BOS>). 
+        // The recursion is unrolled, starting from the base case.
         
-        // Compute ProbContDisc(w|c)
-        double prob_cont_disc = den != 0 ? num / den : 0;
+        if (word == BOS_ID) 
+                return -1;
+        KgramCodes codes(state, word);
+        size_t m = state.order(), resolved = 0;
         
-        // handle directly the 1-gram probability case
-        if (context == "") {
-                num = f_[1].size() - 1; // Remove BOS from seen words count.
-                double backoff_fac = den != 0 ? D_ * num / den : 1;
-                double prob_cont_backoff = 1 / (double)(V() + 2);
+        // Continuation probabilities in the backed off contexts, of 
+        // increasing order.
+        double prob_cont = 1 / (double)(V() + 2);
+        for (size_t order = 0; order < m; ++order) {
+                // Denominator of ProbContDisc(w|c) and BackoffFac(c) are 
+                // precomputed, see KNWeights
+                ContextWeights cw = weights(order, state);
+                double count = knf_.l().query(order + 1, codes[order]);
+                if (instrumented and count > 0) resolved = order + 1;
+                double num = count - D_;
+                num = num > 0 ? num : 0;
                 // den == 0 is a silly case which should be barred from existing
-                return prob_cont_disc + backoff_fac * prob_cont_backoff;
+                double prob_cont_disc = cw.den != 0 ? num / cw.den : 0;
+                prob_cont = prob_cont_disc + cw.gamma * prob_cont;
         }
         
-        // Compute BackoffFac(c)
-        double backoff_fac = den != 0 ? 
-                D_ * knf_.r().query(order - 1, context) / den : 1;
-        
-        // Backoff the k-gram code
-        size_t pos = context.find_first_of(" ");
-        context = (pos != std::string::npos) ? context.substr(pos + 1) : "";
+        // Count(c) and BackoffFac(c) are precomputed, see KNWeights
+        ContextWeights cw = weights(m, state);
+        double count = f_.query(m + 1, codes[m]);
+        if (instrumented) count_resolved(count > 0 ? m + 1 : resolved);
+        double num = count - D_;
+        num = num > 0 ? num : 0;
         
-        // Compute ProbCont(w|c--)
-        double prob_cont_backoff = prob_cont(word, context, order - 1);
+        // Compute ProbDisc(w|c)
+        double prob_disc = cw.den > 0 ? num / cw.den : 0;
         
-        return prob_cont_disc + backoff_fac * prob_cont_backoff;
+        return prob_disc + cw.gamma * prob_cont;
+}
+
+/// @brief Return Kneser-Ney continuation probabilities of a word given a 
+/// context state, for models of all orders up to N.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of doubles. Output probabilities: res[k] is the 
+/// probability given by a model of order k + 1.
+/// @details Models of different orders only differ in their highest order 
+/// term, while the continuation probabilities ProbCont(w|c--) computed 
+/// bottom-up in prob() are shared by all of them.
+void KNSmoother::prob_orders (int word, 
+                              const State & state, 
+                              std::vector<double> & res) const 
+{
+        size_t m = state.order();
+        res.assign(m + 1, -1);
+        if (word == BOS_ID) 
+                return;
+        KgramCodes codes(state, word);
+        double prob_cont = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= m; ++order) {
+                const std::string & code = codes[order];
+                
+                // Highest order term of the model of order 'order + 1'
+                ContextWeights cw = order < m ? 
+                        knw_.high(order, state.keys[order]) : weights(m, state);
+                double num = f_.query(order + 1, code) - D_;
+                num = num > 0 ? num : 0;
+                double prob_disc = cw.den > 0 ? num / cw.den : 0;
+                res[order] = prob_disc + cw.gamma * prob_cont;
+                if (order == m)
+                        break;
+                
+                // Continuation term of higher order models
+                cw = weights(order, state);
+                num = knf_.l().query(order + 1, code) - D_;
+                num = num > 0 ? num : 0;
+                double prob_cont_disc = cw.den != 0 ? num / cw.den : 0;
+                prob_cont = prob_cont_disc + cw.gamma * prob_cont;
+        }
+}
+
+/// @brief Context dependent terms of Kneser-Ney probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return Context counts and backoff factor of the term of order 'order' of
+/// the interpolation recursion, see KNWeights.
+ContextWeights KNSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        const std::string & context = state.keys[order];
+        return order == state.order() ? 
+                knw_.high(order, context) : knw_.low(order, context);
+}
+
+/// @brief Discount independent counts entering the Kneser-Ney probability of
+/// a word given a context.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of DiscountStats. Output statistics of the 
+/// interpolation terms of all orders, from 0 to state.order(). See prob().
+void KNSmoother::discount_stats (int word, 
+                                 const State & state, 
+                                 std::vector<DiscountStats> & res) const 
+{
+        KgramCodes codes(state, word);
+        size_t m = state.order();
+        res.resize(m + 1);
+        // N1+(.) without considering <BOS>, used for the empty context
+        double N1p_empty = f_[1].size() - 1;
+        for (size_t order = 0; order <= m; ++order) {
+                const std::string & context = state.keys[order];
+                DiscountStats & s = res[order];
+                if (order < m) { // Continuation terms
+                        s.num = knf_.l().query(order + 1, codes[order]);
+                        s.den = knf_.lr().query(order, context);
+                } else { // Highest order term
+                        s.num = f_.query(order + 1, codes[order]);
+                        s.den = f_.query(order, context);
+                }
+                s.N1 = order > 0 ? knf_.r().query(order, context) : N1p_empty;
+                s.N2 = s.N3p = 0;
+        }
+}
+
+/// @brief Kneser-Ney probability of a word from its discount_stats(), for a 
+/// given discount.
+/// @param stats Pointer to the DiscountStats of all orders.
+/// @param n A positive integer. Number of orders.
+/// @param D Pointer to the discount.
+/// @return The value prob() would return if the discount was set to D[0].
+double KNSmoother::discounted_prob (const DiscountStats * stats, 
+                                    size_t n,
+                                    const double * D) const 
+{
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order < n; ++order) {
+                const DiscountStats & s = stats[order];
+                // Same arithmetic as KNWeights::update() and prob() 
+                double gamma = s.den != 0 ? D[0] * s.N1 / s.den : 1;
+                double num = s.num - D[0];
+                num = num > 0 ? num : 0;
+                double prob_disc = s.den > 0 ? num / s.den : 0;
+                prob = prob_disc + gamma * prob;
+        }
+        return prob;
+}
+
+// Compute context counts and backoff factor of a term of the interpolation 
+// recursion (the highest order term if 'high' is true, a continuation term 
+// otherwise), and the discounted probabilities of words observed after the 
+// context.
+ContextWeights KNSmoother::term (
+                size_t order, const std::string & context, bool high, 
+                SparseProbs & disc
+) const {
+        ContextWeights cw = high ? 
+                knw_.high(order, context) : knw_.low(order, context);
+        disc.clear();
+        if (cw.den == 0) 
+                return cw;
+        auto add = [&](int id, double num) {
+                num -= D_;
+                num = num > 0 ? num : 0;
+                disc.emplace_back(id, num / cw.den);
+        };
+        // Words with zero continuation count contribute nothing, and are 
+        // skipped when using the index of continuation counts.
+        if (high) 
+                for_each_follower(order, context, add);
+        else if (knf_.indexed())
+                for (const Follower & w : knf_.l_followers(order, context))
+                        add(w.id, (double)w.count);
+        else 
+                for_each_follower(order, context, [&](int id, double) {
+                        add(id, knf_.l().query(
+                                order + 1, join(context, std::to_string(id))
+                                ));
+                });
+        return cw;
+}
+
+/// @brief Base distribution of Kneser-Ney probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details This is the lowest order term of the interpolation, i.e. the 
+/// continuation probabilities ProbCont(w|) for contexts of positive order, 
+/// and the full distribution for the empty context.
+void KNSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        res.assign(V() + 2, 1 / (double)(V() + 2));
+        SparseProbs disc;
+        ContextWeights cw = term(0, "", order == 0, disc);
+        interpolate(res, disc, cw.gamma);
+}
+
+/// @brief Return Kneser-Ney continuation probabilities of all words given a
+/// context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details The recursion of prob() is unrolled bottom-up, over all words: 
+/// context dependent terms are computed once per order, and per-word tables 
+/// are only queried for words observed after the context.
+void KNSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        size_t m = state.order();
+        base_distribution(m, res);
+        SparseProbs disc;
+        for (size_t k = 1; k <= m; ++k) {
+                ContextWeights cw = term(k, state.keys[k], k == m, disc);
+                interpolate(res, disc, cw.gamma);
+        }
+}
+
+/// @brief Decompose the distribution of Kneser-Ney probabilities given a 
+/// context state, see Smoother::sparse_distribution().
+/// @details F(c) contains the words observed after the last word of the 
+/// context, and Gamma(c) is the product of the backoff factors of all terms 
+/// of the interpolation, except for the lowest order one.
+void KNSmoother::sparse_distribution (const State & state, 
+                                      const std::vector<double> & base,
+                                      SparseProbs & probs,
+                                      double & gamma) 
+const {
+        size_t m = state.order();
+        gamma = 1.;
+        probs.clear();
+        if (m == 0) 
+                return;
+        std::unordered_map<int, size_t> pos;
+        init_sparse(1, state.keys[1], base, probs, pos);
+        SparseProbs disc;
+        for (size_t k = 1; k <= m; ++k) {
+                ContextWeights cw = term(k, state.keys[k], k == m, disc);
+                interpolate(probs, pos, disc, cw.gamma);
+                gamma *= cw.gamma;
+        }
 }
 
 //--------//----------------mKNSmoother----------------//--------//
@@ -419,18 +1534,58 @@ void mKNFreqs::update ()
                         }
                 }
         }
+        
+        // Index of left continuation counts by context, see l_followers()
+        indexed_ = f_.followers_index();
+        if (indexed_)
+                lf_.build(l_.tables());
+        else 
+                lf_.clear();
+}
+
+/// @brief update context counts of mKNSmoother
+void mKNWeights::update ()
+{
+        high_ = ContextTablesVec<Counts>(f_.N());
+        low_ = ContextTablesVec<Counts>(f_.N() - 1);
+        
+        // Contexts of the highest order term: den = Count(c), and
+        //      BackoffFac(c) = (D1 * N1 + D2 * N2 + D3 * N3+) / Count(c)
+        for (size_t k = 0; k < f_.N(); ++k) {
+                for (const auto & p : f_[k]) {
+                        double den = p.second;
+                        if (den == 0) continue;
+                        double N1 = mknf_.r1().query(k, p.first);
+                        double N2 = mknf_.r2().query(k, p.first);
+                        double N3p = mknf_.r3p().query(k, p.first);
+                        high_[k][p.first] = Counts{den, N1, N2, N3p};
+                }
+        }
+        
+        // Contexts of continuation terms: den = N1+(*,c,*), and
+        //      BackoffFac(c) = (D1 * N1 + D2 * N2 + D3 * N3+) / N1+(*,c,*)
+        // where the N's are computed from left continuation counts.
+        for (size_t k = 0; k < f_.N() - 1; ++k) {
+                for (const auto & p : mknf_.lr()[k]) {
+                        double den = p.second;
+                        if (den == 0) continue;
+                        double N1 = mknf_.r1low().query(k, p.first);
+                        double N2 = mknf_.r2low().query(k, p.first);
+                        double N3p = mknf_.r3plow().query(k, p.first);
+                        low_[k][p.first] = Counts{den, N1, N2, N3p};
+                }
+        }
 }
 
 /// @brief Return Modified Kneser-Ney continuation probability of a word
 /// given a context.
-/// @param word A string. Word for which the continuation probability
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Modified Kneser-Ney continuation
 /// probability of 'word' given 'context'.
-double mKNSmoother::operator() (const std::string & word, std::string context) 
-const {
+double mKNSmoother::prob (int word, const State & state) const 
+{
         // The probability of word 'w' in context 'c' is given by:
         //
         //      Prob(w|c) = ProbDisc(w|c) + BackoffFac(c) * ProbCont(w|c--)
@@ -443,108 +1598,263 @@ const {
         //      ProbCont(w|c--) = Continuation probability of 'w|c--' 
         //
         // Here N1+(c,*) = (# different words following context 'c') is the
-        // continuation count; []+ denotes positive part; the continuation 
-        // probability is defined below. For the base case, we replace
+        // continuation count; []+ denotes positive part; the discount D 
+        // depends on the count, see discount(). The continuation probability 
+        // of word 'w' in context 'c' is in turn given by:
+        //
+        //      ProbCont(w|c) = ProbContDisc(w|c) + 
+        //                              BackoffFac(c) * ProbCont(w|c--)
+        //
+        // where:
+        //
+        //      ProbContDisc(w|c) = [N1+(*,c,w)-D]+ / N1+(*,c,*)
+        //      BackoffFac(c) = 1 - sum_w(ProbContDisc(w|c))
+        //                    = D * N1+(c,*) / N1+(*,c,*)
+        //
+        // For the base case, we replace
         //      ProbCont(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
+        // where V is the number of words in the dictionary (without <BOS>). 
+        // The recursion is unrolled, starting from the base case.
         
         // Handle n.d. cases
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+        if (word == BOS_ID) 
                 return -1;
-        // keep at most N - 1 words
-        context = truncate(context, N_); 
+        KgramCodes codes(state, word);
+        size_t m = state.order(), resolved = 0;
+        
+        // Continuation probabilities in the backed off contexts, of 
+        // increasing order.
+        double prob_cont = 1 / (double)(V() + 2);
+        for (size_t order = 0; order < m; ++order) {
+                // Denominator of ProbContDisc(w|c) and BackoffFac(c) are 
+                // precomputed, see mKNWeights
+                ContextWeights cw = weights(order, state);
+                double prob_cont_disc;
+                if (cw.den > 0){
+                        double num = mknf_.l().query(order + 1, codes[order]);
+                        if (instrumented and num > 0) resolved = order + 1;
+                        discount(num);
+                        prob_cont_disc = num / cw.den;
+                } else
+                        prob_cont_disc = 0;
+                prob_cont = prob_cont_disc + cw.gamma * prob_cont;
+        }
         
-        // Temporary variable needed below; this is a pair {order, code} 
-        auto p = f_.kgram_code(context);
+        // Count(c) and BackoffFac(c) are precomputed, see mKNWeights
+        ContextWeights cw = weights(m, state);
         
         // Compute ProbDisc(w|c)
         double prob_disc;
-        double den = f_.query(context);
-        if (den > 0) {
-                double num = f_.query(context + " " + word);
+        if (cw.den > 0) {
+                double num = f_.query(m + 1, codes[m]);
+                if (instrumented and num > 0) resolved = m + 1;
                 discount(num);
-                prob_disc = num / den;
+                prob_disc = num / cw.den;
         }
         else 
                 prob_disc = 0.;
         
-        // Compute BackoffFac(c)
-        double backoff_fac;
-        if (den > 0) {
-                double N1 = mknf_.r1().query(p.first, p.second);
-                double N2 = mknf_.r2().query(p.first, p.second);
-                double N3p = mknf_.r3p().query(p.first, p.second);
-                backoff_fac = (D1_ * N1 + D2_ * N2 + D3_ * N3p) / den;
-        } else 
-                backoff_fac = 1.;
-        
-        // Compute ProbCont(w|c--)
-        double prob_cont;
-        std::string word_index = f_.index(word);
-        size_t pos = p.second.find_first_of(" ");
-        p.second = (pos != std::string::npos) ? p.second.substr(pos + 1) : "";
-        prob_cont = this->prob_cont(word_index, p.second, p.first);  
+        if (instrumented) count_resolved(resolved);
         
         // Final result
-        return prob_disc + backoff_fac * prob_cont;
+        return prob_disc + cw.gamma * prob_cont;
 }
 
+/// @brief Return Modified Kneser-Ney continuation probabilities of a word 
+/// given a context state, for models of all orders up to N.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of doubles. Output probabilities: res[k] is the 
+/// probability given by a model of order k + 1.
+/// @details See KNSmoother::prob_orders().
+void mKNSmoother::prob_orders (int word, 
+                               const State & state, 
+                               std::vector<double> & res) const 
+{
+        size_t m = state.order();
+        res.assign(m + 1, -1);
+        if (word == BOS_ID) 
+                return;
+        KgramCodes codes(state, word);
+        double prob_cont = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= m; ++order) {
+                const std::string & code = codes[order];
+                
+                // Highest order term of the model of order 'order + 1'
+                ContextWeights cw = order < m ? 
+                        mknw_.high(order, state.keys[order]) : 
+                        weights(m, state);
+                double prob_disc = 0.;
+                if (cw.den > 0) {
+                        double num = f_.query(order + 1, code);
+                        discount(num);
+                        prob_disc = num / cw.den;
+                }
+                res[order] = prob_disc + cw.gamma * prob_cont;
+                if (order == m)
+                        break;
+                
+                // Continuation term of higher order models
+                cw = weights(order, state);
+                double prob_cont_disc = 0.;
+                if (cw.den > 0) {
+                        double num = mknf_.l().query(order + 1, code);
+                        discount(num);
+                        prob_cont_disc = num / cw.den;
+                }
+                prob_cont = prob_cont_disc + cw.gamma * prob_cont;
+        }
+}
 
-// Compute continuation probability of word in a given context. 'order' is the
-// k-gram order of context, passed for efficiency.
-double mKNSmoother::prob_cont (
-                const std::string & word, std::string context, size_t order
+/// @brief Context dependent terms of Modified Kneser-Ney probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return See KNSmoother::context_weights().
+ContextWeights mKNSmoother::context_weights (
+                size_t order, const State & state
 ) const {
-        // The continuation probability of word 'w' in context 'c' is given by:
-        //
-        //      ProbCont(w|c) = ProbContDisc(w|c) + 
-        //                              BackoffFac(c) * ProbCont(w|c--)
-        //
-        // where c-- is the backed-off context (remove first word from 'c') and:
-        //
-        //      ProbContDisc(w|c) = [N1+(*,c,w)-D]+ / N1+(*,c,*)
-        //      BackoffFac(c) = 1 - sum_w(ProbContDisc(w|c))
-        //                    = D * N1+(c,*) / N1+(*,c,*)
-        //      ProbCont(w|c--) = Continuation probability of 'w|c--'
-        // For the base case, we replace
-        //      ProbCont(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
-        if (order == 0)
-                return 1 / (double)(V() + 2);
-        
-        // Compute ProbContDisc(w|c)
-        double prob_cont_disc;
-        double den = mknf_.lr().query(order - 1, context);
-        if (den > 0){
-                double num = mknf_.l().query(
-                        order, context != "" ? context + " " + word : word
-                );
+        const std::string & context = state.keys[order];
+        return order == state.order() ? 
+                mknw_.high(order, context) : mknw_.low(order, context);
+}
+
+/// @brief Discount independent counts entering the modified Kneser-Ney 
+/// probability of a word given a context.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of DiscountStats. Output statistics of the 
+/// interpolation terms of all orders, from 0 to state.order(). See prob().
+void mKNSmoother::discount_stats (int word, 
+                                  const State & state, 
+                                  std::vector<DiscountStats> & res) const 
+{
+        KgramCodes codes(state, word);
+        size_t m = state.order();
+        res.resize(m + 1);
+        for (size_t order = 0; order <= m; ++order) {
+                const std::string & context = state.keys[order];
+                DiscountStats & s = res[order];
+                if (order < m) { // Continuation terms
+                        s.num = mknf_.l().query(order + 1, codes[order]);
+                        s.den = mknf_.lr().query(order, context);
+                        s.N1 = mknf_.r1low().query(order, context);
+                        s.N2 = mknf_.r2low().query(order, context);
+                        s.N3p = mknf_.r3plow().query(order, context);
+                } else { // Highest order term
+                        s.num = f_.query(order + 1, codes[order]);
+                        s.den = f_.query(order, context);
+                        s.N1 = mknf_.r1().query(order, context);
+                        s.N2 = mknf_.r2().query(order, context);
+                        s.N3p = mknf_.r3p().query(order, context);
+                }
+        }
+}
+
+/// @brief Modified Kneser-Ney probability of a word from its 
+/// discount_stats(), for given discounts.
+/// @param stats Pointer to the DiscountStats of all orders.
+/// @param n A positive integer. Number of orders.
+/// @param D Pointer to the discounts D1, D2 and D3.
+/// @return The value prob() would return if the discounts were set to D.
+double mKNSmoother::discounted_prob (const DiscountStats * stats, 
+                                     size_t n,
+                                     const double * D) const 
+{
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order < n; ++order) {
+                const DiscountStats & s = stats[order];
+                // Same arithmetic as mKNWeights::update() and prob() 
+                double gamma = s.den != 0 ? 
+                        (D[0] * s.N1 + D[1] * s.N2 + D[2] * s.N3p) / s.den : 1;
+                double prob_disc = 0.;
+                if (s.den > 0) {
+                        double num = s.num;
+                        discount(num, D[0], D[1], D[2]);
+                        prob_disc = num / s.den;
+                }
+                prob = prob_disc + gamma * prob;
+        }
+        return prob;
+}
+
+// Compute context counts and backoff factor of a term of the interpolation 
+// recursion, see KNSmoother::term().
+ContextWeights mKNSmoother::term (
+                size_t order, const std::string & context, bool high, 
+                SparseProbs & disc
+) const {
+        ContextWeights cw = high ? 
+                mknw_.high(order, context) : mknw_.low(order, context);
+        disc.clear();
+        if (cw.den == 0) 
+                return cw;
+        auto add = [&](int id, double num) {
                 discount(num);
-                prob_cont_disc = num / den;
-        } else
-                prob_cont_disc = 0;
-        
-        // Compute BackoffFac(c)
-        double backoff_fac;
-        if (den > 0) {
-                double N1 = mknf_.r1low().query(order - 1, context);
-                double N2 = mknf_.r2low().query(order - 1, context);
-                double N3p = mknf_.r3plow().query(order - 1, context);
-                backoff_fac = (D1_ * N1 + D2_ * N2 + D3_ * N3p) / den;
-        } else backoff_fac = 1.;
-                   
-        
-        // Compute ProbCont(w|c--)
-        double prob_cont_backoff;
-        size_t pos = context.find_first_of(" ");
-        context = (pos != std::string::npos) ? context.substr(pos + 1) : "";
-        prob_cont_backoff = this->prob_cont(word, context, order - 1);  
-        
-        // Final result
-        return prob_cont_disc + backoff_fac * prob_cont_backoff;
+                disc.emplace_back(id, num / cw.den);
+        };
+        if (high) 
+                for_each_follower(order, context, add);
+        else if (mknf_.indexed())
+                for (const Follower & w : mknf_.l_followers(order, context))
+                        add(w.id, (double)w.count);
+        else 
+                for_each_follower(order, context, [&](int id, double) {
+                        add(id, mknf_.l().query(
+                                order + 1, join(context, std::to_string(id))
+                                ));
+                });
+        return cw;
 }
 
+/// @brief Base distribution of Modified Kneser-Ney probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details See KNSmoother::base_distribution().
+void mKNSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        res.assign(V() + 2, 1 / (double)(V() + 2));
+        SparseProbs disc;
+        ContextWeights cw = term(0, "", order == 0, disc);
+        interpolate(res, disc, cw.gamma);
+}
 
+/// @brief Return Modified Kneser-Ney continuation probabilities of all words 
+/// given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details See KNSmoother::distribution().
+void mKNSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        size_t m = state.order();
+        base_distribution(m, res);
+        SparseProbs disc;
+        for (size_t k = 1; k <= m; ++k) {
+                ContextWeights cw = term(k, state.keys[k], k == m, disc);
+                interpolate(res, disc, cw.gamma);
+        }
+}
+
+/// @brief Decompose the distribution of Modified Kneser-Ney probabilities 
+/// given a context state, see KNSmoother::sparse_distribution().
+void mKNSmoother::sparse_distribution (const State & state, 
+                                       const std::vector<double> & base,
+                                       SparseProbs & probs,
+                                       double & gamma) 
+const {
+        size_t m = state.order();
+        gamma = 1.;
+        probs.clear();
+        if (m == 0) 
+                return;
+        std::unordered_map<int, size_t> pos;
+        init_sparse(1, state.keys[1], base, probs, pos);
+        SparseProbs disc;
+        for (size_t k = 1; k <= m; ++k) {
+                ContextWeights cw = term(k, state.keys[k], k == m, disc);
+                interpolate(probs, pos, disc, cw.gamma);
+                gamma *= cw.gamma;
+        }
+}
 
 //--------//----------------AbsSmoother----------------//--------//
 
@@ -583,14 +1893,13 @@ void RFreqs::update ()
 
 /// @brief Return Absolute Discount continuation probability of a word
 /// given a context.
-/// @param word A string. Word for which the continuation probability
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Absolute Discount continuation
 /// probability of 'word' given 'context'.
-double AbsSmoother::operator() (const std::string & word, std::string context) 
-        const {
+double AbsSmoother::prob (int word, const State & state) const 
+{
         // The probability of word 'w' in context 'c' is given by:
         //
         //      Prob(w|c) = ProbDisc(w|c) + BackoffFac(c) * Prob(w|c--)
@@ -603,52 +1912,201 @@ double AbsSmoother::operator() (const std::string & word, std::string context)
         //      Prob(w|c--) = Lowest order probability of 'w|c--' 
         //
         // Here N1+(c,*) = (# different words following context 'c') is the
-        // continuation count; []+ denotes positive part; the continuation 
-        // probability is defined below. For the base case, we replace
+        // continuation count; []+ denotes positive part. For the base case, 
+        // we replace
         //      Prob(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
+        // where V is the number of words in the dictionary (without <BOS>). 
+        // The recursion is unrolled, starting from the base case.
         
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+        if (word == BOS_ID) 
                 return -1;
-        context = truncate(context, N_); // keep at most N - 1 words
-        double den = f_.query(context);
-        double num = f_.query(context + " " + word) - D_;
-        num = num > 0 ? num : 0;
-        
-        // Compute ProbDisc(w|c)
-        double prob_disc = den != 0 ? num / den : 0;
-        
-        // Handle separately the 1-gram probability case
-        if (context == "") {
-                num = f_[1].size() - 1; // N1+(.) without considering <BOS>
-                // Compute BackoffFac(c)
-                double backoff_fac = den != 0 ? D_ * num / den : 1; 
-                // Compute ProbCont(c) (this is potentially > than num!)
-                double prob_cont = 1 / (double)(V() + 2);
-                return prob_disc + backoff_fac * prob_cont;
+        KgramCodes codes(state, word);
+        size_t resolved = 0;
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= state.order(); ++order) {
+                // Count(c) and BackoffFac(c), see context_weights()
+                ContextWeights cw = weights(order, state);
+                double count = f_.query(order + 1, codes[order]);
+                if (instrumented and count > 0) resolved = order + 1;
+                double num = count - D_;
+                num = num > 0 ? num : 0;
+                
+                // Compute ProbDisc(w|c)
+                double prob_disc = cw.den != 0 ? num / cw.den : 0;
+                prob = prob_disc + cw.gamma * prob;
+        }
+        if (instrumented) count_resolved(resolved);
+        return prob;
+}
+
+/// @brief Return Absolute Discount continuation probabilities of a word given
+/// a context state, for models of all orders up to N.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of doubles. Output probabilities: res[k] is the 
+/// probability given by a model of order k + 1.
+/// @details The partial results of the bottom-up loop of prob() are the 
+/// probabilities of lower order models.
+void AbsSmoother::prob_orders (int word, 
+                               const State & state, 
+                               std::vector<double> & res) const 
+{
+        size_t m = state.order();
+        res.assign(m + 1, -1);
+        if (word == BOS_ID) 
+                return;
+        KgramCodes codes(state, word);
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= m; ++order) {
+                ContextWeights cw = weights(order, state);
+                double num = f_.query(order + 1, codes[order]) - D_;
+                num = num > 0 ? num : 0;
+                double prob_disc = cw.den != 0 ? num / cw.den : 0;
+                res[order] = prob = prob_disc + cw.gamma * prob;
+        }
+}
+
+/// @brief Context dependent terms of Absolute Discount probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return Count(c) and BackoffFac(c) for the context suffix of order 
+/// 'order', see prob().
+ContextWeights AbsSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        const std::string & context = state.keys[order];
+        double den = f_.query(order, context);
+        // N1+(.) without considering <BOS> for the empty context
+        double num = order > 0 ? absf_.r(order, context) : f_[1].size() - 1;
+        return ContextWeights{den, den != 0 ? D_ * num / den : 1};
+}
+
+/// @brief Discount independent counts entering the Absolute Discount 
+/// probability of a word given a context.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of DiscountStats. Output statistics of the 
+/// interpolation terms of all orders, from 0 to state.order(). See prob().
+void AbsSmoother::discount_stats (int word, 
+                                  const State & state, 
+                                  std::vector<DiscountStats> & res) const 
+{
+        KgramCodes codes(state, word);
+        size_t m = state.order();
+        res.resize(m + 1);
+        for (size_t order = 0; order <= m; ++order) {
+                const std::string & context = state.keys[order];
+                DiscountStats & s = res[order];
+                s.num = f_.query(order + 1, codes[order]);
+                s.den = f_.query(order, context);
+                // N1+(.) without considering <BOS> for the empty context
+                s.N1 = order > 0 ? absf_.r(order, context) : f_[1].size() - 1;
+                s.N2 = s.N3p = 0;
+        }
+}
+
+/// @brief Absolute Discount probability of a word from its discount_stats(), 
+/// for a given discount.
+/// @param stats Pointer to the DiscountStats of all orders.
+/// @param n A positive integer. Number of orders.
+/// @param D Pointer to the discount.
+/// @return The value prob() would return if the discount was set to D[0].
+double AbsSmoother::discounted_prob (const DiscountStats * stats, 
+                                     size_t n,
+                                     const double * D) const 
+{
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order < n; ++order) {
+                const DiscountStats & s = stats[order];
+                // Same arithmetic as context_weights() and prob()
+                double gamma = s.den != 0 ? D[0] * s.N1 / s.den : 1;
+                double num = s.num - D[0];
+                num = num > 0 ? num : 0;
+                double prob_disc = s.den != 0 ? num / s.den : 0;
+                prob = prob_disc + gamma * prob;
+        }
+        return prob;
+}
+
+// Compute the backoff factor of a term of the interpolation recursion, and 
+// the discounted probabilities of words observed after the context.
+double AbsSmoother::term (
+                size_t order, const std::string & context, SparseProbs & disc
+) const {
+        double den = f_.query(order, context);
+        disc.clear();
+        if (den == 0) 
+                return 1.;
+        for_each_follower(order, context, [&](int id, double count) {
+                double num = count - D_;
+                num = num > 0 ? num : 0;
+                disc.emplace_back(id, num / den);
+        });
+        // N1+(.) without considering <BOS> for the empty context
+        double num = order > 0 ? absf_.r(order, context) : f_[1].size() - 1;
+        return D_ * num / den;
+}
+
+/// @brief Base distribution of Absolute Discount probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details This is the distribution for the empty context, for any order.
+void AbsSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        res.assign(V() + 2, 1 / (double)(V() + 2));
+        SparseProbs disc;
+        double gamma = term(0, "", disc);
+        interpolate(res, disc, gamma);
+}
+
+/// @brief Return Absolute Discount continuation probabilities of all words 
+/// given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details See KNSmoother::distribution().
+void AbsSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        base_distribution(0, res);
+        SparseProbs disc;
+        for (size_t k = 1; k <= state.order(); ++k) {
+                double gamma = term(k, state.keys[k], disc);
+                interpolate(res, disc, gamma);
+        }
+}
+
+/// @brief Decompose the distribution of Absolute Discount probabilities 
+/// given a context state, see KNSmoother::sparse_distribution().
+void AbsSmoother::sparse_distribution (const State & state, 
+                                       const std::vector<double> & base,
+                                       SparseProbs & probs,
+                                       double & gamma) 
+const {
+        size_t m = state.order();
+        gamma = 1.;
+        probs.clear();
+        if (m == 0) 
+                return;
+        std::unordered_map<int, size_t> pos;
+        init_sparse(1, state.keys[1], base, probs, pos);
+        SparseProbs disc;
+        for (size_t k = 1; k <= m; ++k) {
+                double g = term(k, state.keys[k], disc);
+                interpolate(probs, pos, disc, g);
+                gamma *= g;
         }
-        
-        // Compute BackoffFac(c)
-        double backoff_fac = den != 0 ? D_ * absf_.query(context) / den : 1;
-        
-        // Compute lower order probability
-        backoff(context);
-        double prob_backoff = this->operator()(word, context);
-        return prob_disc + backoff_fac * prob_backoff;
 }
 
 //--------//----------------WBSmoother----------------//--------//
 
 /// @brief Return Witten-Bell continuation probability of a word
 /// given a context.
-/// @param word A string. Word for which the continuation probability
-/// is to be computed.
-/// @param context A string. Context conditioning the probability of
-/// 'word'.
+/// @param word An integer. ID of the word for which the continuation 
+/// probability is to be computed.
+/// @param state A State. Context conditioning the probability of 'word'.
 /// @return a positive number. Witten-Bell continuation
 /// probability of 'word' given 'context'.
-double WBSmoother::operator() (const std::string & word, std::string context) 
-        const {
+double WBSmoother::prob (int word, const State & state) const 
+{
         // The probability of word 'w' in context 'c' is given by:
         //
         //      Prob(w|c) = ProbHigh(w|c) + BackoffFac(c) * Prob(w|c--)
@@ -661,43 +2119,211 @@ double WBSmoother::operator() (const std::string & word, std::string context)
         //      Prob(w|c--) = Lowest order probability of 'w|c--' 
         //
         // Here N1+(c,*) = (# different words following context 'c') is the
-        // continuation count; []+ denotes positive part; the continuation 
-        // probability is defined below. For the base case, we replace
+        // continuation count. For the base case, we replace
         //      Prob(w|) = 1 / V,
-        // where V is the number of words in the dictionary (without <BOS>)
+        // where V is the number of words in the dictionary (without <BOS>). 
+        // The recursion is unrolled, starting from the base case.
         
-        if (word == BOS_TOK or word.find_first_not_of(" ") == std::string::npos) 
+        if (word == BOS_ID) 
                 return -1;
-        context = truncate(context, N_); // keep at most N - 1 words
-        double c_context = f_.query(context);
-        double N1p_context = wbf_.query(context);
-        double c_kgram = f_.query(context + " " + word);
+        KgramCodes codes(state, word);
+        size_t resolved = 0;
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= state.order(); ++order) {
+                // Count(c) + N1+(c,*) and N1+(c,*), see context_weights()
+                ContextWeights cw = weights(order, state);
+                double N1p_context = cw.gamma;
+                double c_kgram = f_.query(order + 1, codes[order]);
+                if (instrumented and c_kgram > 0) resolved = order + 1;
+                double den = cw.den;
+                if (den != 0)
+                        prob = (c_kgram + N1p_context * prob) / den;
+        }
+        if (instrumented) count_resolved(resolved);
+        return prob;
+}
+
+/// @brief Return Witten-Bell continuation probabilities of a word given
+/// a context state, for models of all orders up to N.
+/// @param word An integer. ID of the word.
+/// @param state A State. Context conditioning the probability of 'word'.
+/// @param res A vector of doubles. Output probabilities: res[k] is the 
+/// probability given by a model of order k + 1.
+/// @details The partial results of the bottom-up loop of prob() are the 
+/// probabilities of lower order models.
+void WBSmoother::prob_orders (int word, 
+                              const State & state, 
+                              std::vector<double> & res) const 
+{
+        size_t m = state.order();
+        res.assign(m + 1, -1);
+        if (word == BOS_ID) 
+                return;
+        KgramCodes codes(state, word);
+        double prob = 1 / (double)(V() + 2);
+        for (size_t order = 0; order <= m; ++order) {
+                ContextWeights cw = weights(order, state);
+                double c_kgram = f_.query(order + 1, codes[order]);
+                if (cw.den != 0)
+                        prob = (c_kgram + cw.gamma * prob) / cw.den;
+                res[order] = prob;
+        }
+}
+
+/// @brief Context dependent terms of Witten-Bell probabilities.
+/// @param order A positive integer. Order of the context suffix.
+/// @param state A State.
+/// @return For the context suffix of order 'order', 'den' is 
+/// Count(c) + N1+(c,*), and 'gamma' is N1+(c,*) (rather than the backoff 
+/// factor N1+(c,*) / den, in order to reproduce prob() exactly).
+ContextWeights WBSmoother::context_weights (
+                size_t order, const State & state
+) const {
+        const std::string & context = state.keys[order];
+        double N1p_context = wbf_.r(order, context);
+        return ContextWeights{f_.query(order, context) + N1p_context, 
+                              N1p_context};
+}
+
+/// @brief Base distribution of Witten-Bell probabilities.
+/// @param order A positive integer. Order of the context.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details This is the distribution for the empty context, for any order.
+void WBSmoother::base_distribution (size_t order, std::vector<double> & res) 
+const {
+        res.assign(V() + 2, 1 / (double)(V() + 2));
+        double c_context = f_.query(0, "");
+        double N1p_context = wbf_.r(0, "");
         double den = c_context + N1p_context;
-        double prob_backoff;
-        if (context == "")
-                prob_backoff = 1 / (double)(V() + 2);
-        else {
-                backoff(context);
-                prob_backoff = this->operator()(word, context);
+        if (den == 0) 
+                return;
+        // Words observed after context, computed from the lower order 
+        // probabilities before these are overwritten
+        SparseProbs high;
+        for_each_follower(0, "", [&](int id, double count) {
+                size_t i = dense_index(id);
+                high.emplace_back(i, (count + N1p_context * res[i]) / den);
+        });
+        for (double & p : res)
+                p = N1p_context * p / den;
+        for (const auto & h : high)
+                res[h.first] = h.second;
+}
+
+/// @brief Return Witten-Bell continuation probabilities of all words 
+/// given a context state.
+/// @param state A State. Context conditioning the probabilities.
+/// @param res A vector of doubles. Output probabilities, see dense_index().
+/// @details See KNSmoother::distribution().
+void WBSmoother::distribution (const State & state, std::vector<double> & res) 
+const {
+        base_distribution(0, res);
+        SparseProbs high;
+        for (size_t order = 1; order <= state.order(); ++order) {
+                const std::string & context = state.keys[order];
+                double c_context = f_.query(order, context);
+                double N1p_context = wbf_.r(order, context);
+                double den = c_context + N1p_context;
+                if (den == 0) 
+                        continue;
+                high.clear();
+                for_each_follower(order, context, [&](int id, double count) {
+                        size_t i = dense_index(id);
+                        high.emplace_back(i, (count + N1p_context * res[i]) / den);
+                });
+                for (double & p : res)
+                        p = N1p_context * p / den;
+                for (const auto & h : high)
+                        res[h.first] = h.second;
+        }
+}
+
+/// @brief Decompose the distribution of Witten-Bell probabilities given a 
+/// context state, see KNSmoother::sparse_distribution().
+void WBSmoother::sparse_distribution (const State & state, 
+                                      const std::vector<double> & base,
+                                      SparseProbs & probs,
+                                      double & gamma) 
+const {
+        size_t m = state.order();
+        gamma = 1.;
+        probs.clear();
+        if (m == 0) 
+                return;
+        std::unordered_map<int, size_t> pos;
+        init_sparse(1, state.keys[1], base, probs, pos);
+        for (size_t order = 1; order <= m; ++order) {
+                const std::string & context = state.keys[order];
+                double c_context = f_.query(order, context);
+                double N1p_context = wbf_.r(order, context);
+                double den = c_context + N1p_context;
+                if (den == 0) 
+                        continue;
+                // Same operations as in distribution(), in the same order 
+                for (auto & p : probs)
+                        p.second = N1p_context * p.second;
+                for_each_follower(order, context, [&](int id, double count) {
+                        double & p = probs[pos.at(id)].second;
+                        p = count + p;
+                });
+                for (auto & p : probs)
+                        p.second /= den;
+                gamma *= N1p_context / den;
         }
-        
-        double res = den == 0 ? prob_backoff :
-                (c_kgram + N1p_context * prob_backoff) 
-                / (c_context + N1p_context);
-                
-        return res;
 }
 
+//--------//----------------Kernels instantiation----------------//--------//
 
-int main () {
-        std::vector<std::string> text = {"a a b a b a"};
-        kgramFreqs f(2);
-        f.process_sentences(text);
-        mKNSmoother m(f, 2, 0.25, 0.5, 0.75);
-        double prob_a = m("a", "b");
-        double prob_b = m("b", "b");
-        double prob_eos = m(EOS_TOK, "b");
-        double prob_unk = m(UNK_TOK, "b");
-        double sum = prob_a + prob_b + prob_eos + prob_unk;
-        return 0;
-}
\ No newline at end of file
+#define INSTANTIATE_KERNELS(S)                                                 \
+        template std::pair<double, size_t>                                     \
+                sentence_log_prob<S> (const S &,                               \
+                                      const std::string &,                     \
+                                      HitProfile *);                           \
+        template void score_batch<S> (const S &,                               \
+                                      const std::vector<std::string> &,        \
+                                      std::vector<double> &,                   \
+                                      std::vector<size_t> &,                   \
+                                      size_t,                                  \
+                                      HitProfile *);                           \
+        template void score_batch_orders<S> (const S &,                        \
+                                             const std::vector<std::string> &, \
+                                             std::vector<double> &,            \
+                                             std::vector<size_t> &,            \
+                                             size_t,                           \
+                                             HitProfile *);                    \
+        template double score_stream<S> (const S &,                            \
+                                         std::istream &,                       \
+                                         const TextProcessor &,                \
+                                         size_t &,                             \
+                                         size_t,                               \
+                                         size_t,                               \
+                                         SentenceScores *,                     \
+                                         HitProfile *);                        \
+        template double score_encoded<S> (const S &,                           \
+                                          const EncodedCorpus &,               \
+                                          size_t &,                            \
+                                          size_t,                              \
+                                          SentenceScores *,                    \
+                                          HitProfile *);
+
+INSTANTIATE_KERNELS(Smoother)
+INSTANTIATE_KERNELS(SBOSmoother)
+INSTANTIATE_KERNELS(AddkSmoother)
+INSTANTIATE_KERNELS(MLSmoother)
+INSTANTIATE_KERNELS(KNSmoother)
+INSTANTIATE_KERNELS(mKNSmoother)
+INSTANTIATE_KERNELS(AbsSmoother)
+INSTANTIATE_KERNELS(WBSmoother)
+
+#define INSTANTIATE_GRID_KERNELS(S)                                            \
+        template void score_discount_grid<S> (                                 \
+                const S &,                                                     \
+                const std::vector<std::string> &,                              \
+                const std::vector<std::vector<double>> &,                      \
+                std::vector<double> &,                                         \
+                size_t &,                                                      \
+                size_t);
+
+INSTANTIATE_GRID_KERNELS(KNSmoother)
+INSTANTIATE_GRID_KERNELS(mKNSmoother)
+INSTANTIATE_GRID_KERNELS(AbsSmoother)
@@ -7,9 +7,97 @@
 
 #include "kgramFreqs.h"
 #include "Satellite.h"
+#include "LRUCache.h"
+#include "TextProcessor.h"
 #include <cmath>
+#include <istream>
 #include <limits>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+/// @struct ContextWeights
+/// @brief Context dependent terms of interpolated smoothers.
+struct ContextWeights {
+        double den; ///< @brief Denominator of discounted probabilities
+        double gamma; ///< @brief Backoff factor
+};
+
+/// @struct DiscountStats
+/// @brief Counts entering an interpolation term of a discounting smoother, 
+/// which do not depend on the discounts. 
+/// @details The term can be computed from these for any value of the
+/// discounts, see e.g. KNSmoother::discounted_prob().
+struct DiscountStats {
+        double num; ///< @brief (Continuation) count of the k-gram
+        double den; ///< @brief (Continuation) count of the context
+        /// @brief Number of words following the context with (continuation)
+        /// count equal to 1, 2, and larger than 2. For smoothers with a
+        /// single discount, N1 is the total number of such words, and N2, N3p
+        /// are zero.
+        double N1, N2, N3p;
+};
+
+/// @class State
+/// @brief Context state for incremental scoring.
+/// @details Stores the codes of all suffixes of a context truncated to its 
+/// last N - 1 words: keys[k] is the code of the last k words, so that 
+/// keys[0] is "" and keys.back() is the code of the full (truncated) context. 
+/// These are precisely the keys of the k-gram tables looked up by smoothers,
+/// so that probabilities can be computed, and the state advanced by one word,
+/// without tokenizing strings or looking words up in the Dictionary.
+struct State {
+        std::vector<std::string> keys; ///< @brief Codes of context suffixes
+        
+        /// @brief Optional context dependent terms of all suffixes, indexed 
+        /// as 'keys', see Smoother::context(). 
+        std::shared_ptr<const std::vector<ContextWeights>> weights;
+        
+        /// @brief Order of the context, i.e. its number of words.
+        size_t order () const { return keys.size() - 1; }
+};
+
+/// @class KgramCodes
+/// @brief Codes of the k-grams formed by the suffixes of a context and a word.
+/// @details The code of each k-gram is a suffix of the code of the highest
+/// order one, which is built only once. Lower order codes are copied into a
+/// buffer whose storage is reused, so that backing off through all orders
+/// does not allocate a new string at each order.
+class KgramCodes {
+        const State & state_;
+        std::string word_; ///< @brief Code of the word
+        std::string full_; ///< @brief Code of the highest order k-gram
+        std::string buf_;
+public:
+        /// @param state A State. Must outlive the KgramCodes object.
+        /// @param word An integer. ID of the word.
+        KgramCodes (const State & state, int word)
+                : state_(state), word_(std::to_string(word))
+        {
+                const std::string & context = state_.keys.back();
+                full_.reserve(context.size() + word_.size() + 1);
+                full_ = context;
+                if (not context.empty())
+                        full_ += ' ';
+                full_ += word_;
+        }
+
+        /// @brief Code of the k-gram formed by the context suffix of order
+        /// 'order' and the word. Invalidated by the next call.
+        const std::string & operator[] (size_t order) {
+                if (order == state_.order())
+                        return full_;
+                size_t len = state_.keys[order].size() + word_.size();
+                if (order > 0)
+                        ++len;
+                buf_.assign(full_, full_.size() - len, std::string::npos);
+                return buf_;
+        }
+}; // KgramCodes
+
+/// @brief List of (word ID, probability) pairs.
+using SparseProbs = std::vector<std::pair<int, double>>;
 
 /// @class Smoother
 /// @brief Backbone structure for other smoothers object considered below. 
@@ -17,18 +105,175 @@ class Smoother {
 protected:
         const kgramFreqs & f_; ///< @brief Underlying kgramFreqs object
         size_t N_; ///< @brief order of k-gram model
-        std::string padding_; /// @brief Begin-Of-Sentence padding
+        State bos_; ///< @brief Begin-Of-Sentence state
+        size_t version_ = 0; ///< @brief Number of parameter changes
+        
+        /// @brief Words sorted by decreasing base probability, see 
+        /// base_distribution().
+        struct Ranking {
+                std::vector<double> base; ///< @brief Base distribution
+                std::vector<int> ids; ///< @brief Sorted word IDs (except UNK)
+        };
+        /// @brief Cached rankings, indexed by base_index().
+        mutable std::vector<std::shared_ptr<const Ranking>> rankings_;
+        
+        /// @brief Cached context states, with resolved context dependent 
+        /// terms, indexed by context.
+        mutable LRUCache<std::string, State> cache_;
+        
+        /// @brief Versions of k-gram counts and parameters cached quantities
+        /// were computed from, and mutex guarding rankings_ and versions.
+        mutable size_t cache_f_version_ = 0, cache_version_ = 0;
+        mutable std::mutex cache_mutex_;
+        
+        /// @brief Instrumentation counters: resolved_[k] is the number of 
+        /// probabilities computed by prob() resolved at order k, see 
+        /// count_resolved().
+        std::vector<Counter> resolved_;
+        
+        /// @class Smoother::OrderGuard
+        /// @brief Satellite lowering the order of the smoother when the 
+        /// order of the underlying kgramFreqs is lowered below it, see 
+        /// kgramFreqs::truncate_order(). Registered with the lifetime of the 
+        /// smoother.
+        class OrderGuard : public Satellite {
+                kgramFreqs & f_;
+                Smoother & s_;
+        public:
+                OrderGuard (kgramFreqs & f, Smoother & s) : f_(f), s_(s) 
+                        { f_.add_satellite(this); }
+                OrderGuard (const OrderGuard &) = delete;
+                OrderGuard & operator= (const OrderGuard &) = delete;
+                void update () { if (s_.N_ > f_.N()) s_.set_N(f_.N()); }
+                kgramFreqs & freqs () const { return f_; }
+        } guard_;
+        
         //--------Private methods--------//
         
+        /// @brief Register a probability computed by prob(), resolved at a
+        /// given order. 
+        /// @param order A non-negative integer. Highest order k such that 
+        /// the k-gram formed by the last k - 1 words of the context and the
+        /// word has a non-zero (continuation) count entering the probability, 
+        /// or zero if there is no such k-gram.
+        /// @details Only maintained if the package is compiled with 
+        /// KGRAMS_INSTRUMENT defined, see Instrumentation.h.
+        void count_resolved (size_t order) const { resolved_[order].add(); }
+        
+        /// @brief Context dependent terms of the suffix of order 'order' of a
+        /// context state, see context_weights(). These are read from 'state'
+        /// if resolved, and computed otherwise.
+        ContextWeights weights (size_t order, const State & state) const {
+                return state.weights ? (*state.weights)[order] : 
+                        context_weights(order, state);
+        }
+        
+        /// @brief Register a satellite of derived classes with the 
+        /// underlying kgramFreqs, see kgramFreqs::add_satellite(). Satellites
+        /// remove themselves when destroyed with the smoother.
+        void add_satellite (Satellite * s) { guard_.freqs().add_satellite(s); }
+        
+        /// @brief Signal that parameters have changed. To be called by 
+        /// parameter setters of derived classes.
+        void params_changed () { ++version_; }
         
-        /// @brief truncate 'context' to last N - 1 words.
-        std::string truncate (std::string context, size_t k) const; // Smoothing.cpp
+        /// @brief Clear cached quantities if counts or parameters changed.
+        /// Must be called with cache_mutex_ locked.
+        void sync_cache () const; // Smoothing.cpp
+        
+        /// @brief Ranking of words for contexts of a given order. Computed on
+        /// first use, and recomputed when counts or parameters change.
+        std::shared_ptr<const Ranking> ranking (size_t order) const; 
+                // Smoothing.cpp
+        
+        /// @brief code of the k-gram obtained by appending a word code to a
+        /// context code.
+        static std::string join (const std::string & context, 
+                                 const std::string & word) 
+                { return context.empty() ? word : context + " " + word; }
+        
+        /// @brief Call fun(id, count) for each word observed after a 
+        /// context, where 'count' is the (positive) count of the k-gram formed 
+        /// by context and word.
+        /// @param order A positive integer. Order of the context.
+        /// @param context A string. Code of the context.
+        /// @details Uses the right continuation index of the underlying 
+        /// kgramFreqs if available, and scans the dictionary otherwise.
+        template <class Function>
+        void for_each_follower (size_t order, 
+                                const std::string & context, 
+                                Function fun) const
+        {
+                if (f_.followers_index()) {
+                        for (const Follower & w : f_.followers(order, context))
+                                fun(w.id, (double)w.count);
+                        return;
+                }
+                double count;
+                for (int id = UNK_ID; id <= (int)V(); ++id) {
+                        if (id == BOS_ID) continue;
+                        count = f_.query(order + 1, 
+                                         join(context, std::to_string(id)));
+                        if (count > 0) 
+                                fun(id, count);
+                }
+        }
+        
+        /// @brief Interpolation step on a dense vector of lower order 
+        /// probabilities: res[i] <- disc[i] + gamma * res[i], where 'disc' 
+        /// lists the non-zero discounted probabilities. See dense_index().
+        void interpolate (std::vector<double> & res, 
+                          const SparseProbs & disc, 
+                          double gamma) const 
+        {
+                for (double & p : res)
+                        p = gamma * p;
+                for (const auto & d : disc) {
+                        double & p = res[dense_index(d.first)];
+                        p = d.second + p;
+                }
+        }
+        
+        /// @brief Initialize sparse probabilities with the words observed 
+        /// after a context, and their probabilities from a dense vector.
+        /// @param pos Output positions of words in 'probs'.
+        void init_sparse (size_t order, 
+                          const std::string & context, 
+                          const std::vector<double> & base, 
+                          SparseProbs & probs,
+                          std::unordered_map<int, size_t> & pos) const 
+        {
+                probs.clear(); 
+                pos.clear();
+                for_each_follower(order, context, [&](int id, double) {
+                        pos[id] = probs.size();
+                        probs.emplace_back(id, base[dense_index(id)]);
+                });
+        }
         
-        /// @brief Remove first word from context
-        void backoff (std::string & context) const; // Smoothing.cpp
+        /// @brief Interpolation step on sparse probabilities, see 
+        /// interpolate(). All words in 'disc' must be listed in 'probs'.
+        static void interpolate (SparseProbs & probs, 
+                                 const std::unordered_map<int, size_t> & pos,
+                                 const SparseProbs & disc, 
+                                 double gamma) 
+        {
+                for (auto & p : probs)
+                        p.second = gamma * p.second;
+                for (const auto & d : disc) {
+                        double & p = probs[pos.at(d.first)].second;
+                        p = d.second + p;
+                }
+        }
 public:
         /// @brief constructor
-        Smoother (const kgramFreqs & f, size_t N) : f_(f) { set_N(N); }
+        Smoother (kgramFreqs & f, size_t N) 
+                : f_(f), resolved_(f.N() + 1), guard_(f, *this) { set_N(N); }
+        
+        /// @brief destructor. Smoothers may be deleted through pointers to 
+        /// the base class, which must destroy the satellites of derived 
+        /// classes.
+        virtual ~Smoother () = default;
         
         /// @brief model order getter
         size_t N () const { return N_; }
@@ -48,18 +293,190 @@ public:
         /// @return a string.
         std::string word (std::string index) const { return f_.word(index); }
         
-        /// @brief get smoothed continuation probabilites. 
+        /// @brief Return word from dictionary.
+        /// @param id an integer.
+        /// @return a string.
+        std::string word (int id) const { return f_.word(id); }
+        
+        /// @brief Return ID of word from dictionary.
+        /// @param word a string.
+        /// @return an integer.
+        int id (const std::string & word) const { return f_.id(word); }
+        
+        /// @brief Position of a word in dense vectors of size V + 2, 
+        /// such as the ones returned by distribution().
+        /// @param id an integer. ID of the word (EOS, UNK or dictionary word).
+        /// @return an integer. EOS is at position 0, dictionary words at 
+        /// positions 1 to V, and UNK at position V + 1.
+        size_t dense_index (int id) const { return id >= 0 ? id : V() + 1; }
+        
+        /// @brief ID of the word at a given position of dense vectors of 
+        /// size V + 2. Inverse of dense_index().
+        int dense_id (size_t i) const { return i <= V() ? i : UNK_ID; }
+        
+        //--------Context states--------//
+        
+        /// @brief Begin-Of-Sentence state, i.e. N - 1 BOS tokens.
+        const State & initial_state () const { return bos_; }
+        
+        /// @brief State of a context, truncated to its last N - 1 words.
+        State state (const std::string & context) const; // Smoothing.cpp
+        
+        /// @brief State of a context of word IDs, truncated to its last 
+        /// N - 1 words.
+        State state (const std::vector<int> & ids) const; // Smoothing.cpp
+        
+        /// @brief Resolve the context dependent terms of a state, see 
+        /// context_weights().
+        void resolve (State & state) const; // Smoothing.cpp
+        
+        /// @brief State of a context, with resolved context dependent terms.
+        /// Retrieved from the context cache if enabled.
+        State context (const std::string & context) const; // Smoothing.cpp
+        
+        //--------Context cache--------//
+        
+        /// @brief Maximum number of contexts cached by context(). Zero 
+        /// (the default) disables the cache.
+        size_t cache_capacity () const { return cache_.capacity(); }
+        
+        /// @brief Set cache capacity, clearing the cache and its statistics.
+        void set_cache_capacity (size_t capacity) { 
+                cache_.set_capacity(capacity); 
+                clear_cache(); 
+        }
+        
+        /// @brief Number of cached contexts.
+        size_t cache_size () const { return cache_.size(); }
+        
+        /// @brief Number of cache hits and misses since the last reset.
+        size_t cache_hits () const { return cache_.hits(); }
+        size_t cache_misses () const { return cache_.misses(); }
+        
+        /// @brief Remove all cached contexts, and reset statistics.
+        void clear_cache () { cache_.clear(); cache_.reset_stats(); }
+        
+        //--------Instrumentation--------//
+        
+        /// @brief Number of probabilities computed by prob() resolved at 
+        /// each order k = 0, 1, ..., N, see count_resolved(). The 
+        /// corresponding backoff depth is N - k.
+        std::vector<size_t> resolved () const {
+                std::vector<size_t> res;
+                for (size_t k = 0; k <= N_; ++k)
+                        res.push_back(resolved_[k].value());
+                return res;
+        }
+        
+        /// @brief Reset instrumentation counters.
+        void reset_stats () { for (Counter & c : resolved_) c.reset(); }
+        
+        /// @brief Append a word to a context state (in and out can coincide).
+        void advance (const State & in, int word, State & out) const; 
+        
+        /// @brief Highest order of k-grams ending at a word with a non-zero
+        /// count, given a context state.
+        size_t hit_order (int word, const State & state) const; 
+                // Smoothing.cpp
+        
+        /// @brief Log-probability of a word in a given state, which is then
+        /// advanced (in and out can coincide).
+        double score (const State & in, int word, State & out) const {
+                double p = prob(word, in);
+                advance(in, word, out);
+                return std::log(p);
+        }
+        
+        //--------Probabilities--------//
+        
+        /// @brief Context dependent terms of continuation probabilities,
+        /// for the suffix of order 'order' of a context state. These are 
+        /// cached by context(), and their meaning depends on the smoother.
+        virtual ContextWeights context_weights (size_t order, const State &) 
+                const { return ContextWeights{0, 1}; }
+        
+        /// @brief get smoothed continuation probabilites from word ID and 
+        /// context state. 
         // Mock definition overloaded at run-time by the derived class' actual
         // method.
-        virtual double operator() (const std::string &, std::string) const
-                { return 1. ;}
+        virtual double prob (int word, const State & state) const 
+                { return 1.; }
+        
+        /// @brief Continuation probabilities of a word in a context state, 
+        /// for models of all orders up to N. 
+        /// @details res[k] is the value of prob() for a model of order 
+        /// k + 1, i.e. given the suffix of order k of the context.
+        // Generic definition, overloaded by derived classes which compute 
+        // all orders in a single backoff pass.
+        virtual void prob_orders (int word, 
+                                  const State & state, 
+                                  std::vector<double> & res) const; 
+                // Smoothing.cpp
+        
+        /// @brief get smoothed continuation probabilites of all words in a
+        /// given context state, see dense_index().
+        // Generic definition, overloaded by derived classes with methods 
+        // that compute context dependent terms only once.
+        virtual void distribution (const State &, std::vector<double> &) 
+                const; // Smoothing.cpp
+        
+        //--------Sparse decomposition of distributions--------//
+        // 
+        // For sampling purposes, continuation probabilities are decomposed as:
+        //
+        //      Prob(w|c) = Prob(w|c),              for w in F(c)
+        //      Prob(w|c) = Gamma(c) * Base(w),     otherwise
+        //
+        // where F(c) is a (small) set of words, typically the words observed 
+        // after 'c', and the base distribution Base(w) depends on the context
+        // only through base_index(). Generic definitions are given, which 
+        // list all words in F(c).
+        
+        /// @brief Index of the base distribution for contexts of a given 
+        /// order. Contexts with the same index share the base distribution.
+        virtual size_t base_index (size_t order) const { return 0; }
+        
+        /// @brief Base distribution for contexts of a given order, 
+        /// see dense_index().
+        virtual void base_distribution (size_t order, 
+                                        std::vector<double> & res) const 
+                { res.assign(V() + 2, 1 / (double)(V() + 2)); }
+        
+        /// @brief Probabilities of the words in F(c), and backoff factor 
+        /// Gamma(c). 'base' is the base distribution for the state's order.
+        virtual void sparse_distribution (const State &, 
+                                          const std::vector<double> & base,
+                                          SparseProbs & probs,
+                                          double & gamma) const; 
+        
+        /// @brief Most probable words given a context state.
+        void top_k (const State &, size_t k, SparseProbs &) const; 
+                // Smoothing.cpp
+        
+        /// @brief get smoothed continuation probabilites. 
+        double operator() (const std::string &, const State &) const; 
+        
+        /// @brief get smoothed continuation probabilites. 
+        double operator() (const std::string & word, std::string context) 
+                const { return operator()(word, state(context)); }
         
         /// @brief get smoothed sentence probabilites. 
         std::pair<double, size_t> operator() (
                         const std::string &, bool log = false
         ) const; // Smoothing.cpp
+        
+        /// @brief get sentence log-probabilities and word counts of a batch of
+        /// sentences, using several threads.
+        void score_sentences (const std::vector<std::string> &, 
+                              std::vector<double> &, 
+                              std::vector<size_t> &,
+                              size_t n_threads = 1
+        ) const; // Smoothing.cpp
 };
 
+static_assert(std::has_virtual_destructor<Smoother>::value, 
+              "Smoothers must be deletable through pointers to Smoother.");
+
 /// @class SBOSmoother
 /// @brief Stupid Backoff continuation probability smoother
 class SBOSmoother : public Smoother {
@@ -74,7 +491,7 @@ public:
         /// "bare" k-gram counts are read off.
         /// @param lambda positive number. Penalization in Stupid Backoff 
         /// recursion.
-        SBOSmoother (const kgramFreqs & f, size_t N, const double lambda) 
+        SBOSmoother (kgramFreqs & f, size_t N, const double lambda) 
                 : Smoother(f, N), lambda_(lambda) {}
         
         //--------Parameters getters/setters--------//
@@ -85,12 +502,24 @@ public:
                                 "'lambda' must be between 0 and 1."
                                 );
                 lambda_ = lambda;
+                params_changed();
         }
                 
         //--------Probabilities--------//
         
         // Compute SBO continuation scores. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        size_t base_index (size_t order) const { return order; }
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
 }; // class SBOSmoother
 
 /// @class AddkSmoother
@@ -106,7 +535,7 @@ public:
         /// @param f a kgramFreqs class object. k-gram frequency table from which
         /// "bare" k-gram counts are read off.
         /// @param k positive number. Constant weight added to k-gram counts.
-        AddkSmoother (const kgramFreqs & f, size_t N, const double k) 
+        AddkSmoother (kgramFreqs & f, size_t N, const double k) 
                 : Smoother(f, N), k_(k) 
         {}
         
@@ -118,12 +547,24 @@ public:
                                         "'k' must be positive."
                         );
                 k_ = k;
+                params_changed();
         }
         
         //--------Probabilities--------//
 
         // Addk continuation probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        size_t base_index (size_t order) const { return order > 0; }
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
 }; // class AddkSmoother
 
 /// @class MLSmoother
@@ -136,12 +577,23 @@ public:
         /// fixed constant 'k'.
         /// @param f a kgramFreqs class object. k-gram frequency table from which
         /// "bare" k-gram counts are read off.
-        MLSmoother (const kgramFreqs & f, size_t N) : Smoother(f, N) {}
+        MLSmoother (kgramFreqs & f, size_t N) : Smoother(f, N) {}
         
         //--------Probabilities--------//
         
         // ML continuation probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        size_t base_index (size_t order) const { return order > 0; }
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
 }; // class MLSmoother
 
 class FreqTablesVec {
@@ -154,6 +606,26 @@ public:
                 return it != f_[order].end() ? it->second : 0; 
         }
         FrequencyTable& operator[] (size_t k) { return f_[k]; }
+        const FrequencyTable& operator[] (size_t k) const { return f_[k]; }
+        const std::vector<FrequencyTable> & tables() const { return f_; }
+};
+
+/// @class ContextTablesVec
+/// @brief Per-order hash tables of context counts of type T, indexed by 
+/// context code.
+/// @details Contexts not stored in the tables have zero counts, for which 
+/// we return T{}.
+template <class T>
+class ContextTablesVec {
+        using ContextTable = std::unordered_map<std::string, T>;
+        std::vector<ContextTable> t_;
+public:
+        ContextTablesVec(size_t N) : t_(N) {}
+        T query(size_t order, const std::string & context) const {
+                auto it = t_[order].find(context);
+                return it != t_[order].end() ? it->second : T{};
+        }
+        ContextTable& operator[] (size_t k) { return t_[k]; }
 };
 
 class KNFreqs : public Satellite {
@@ -164,6 +636,11 @@ class KNFreqs : public Satellite {
         FreqTablesVec r_;
         /// @brief Two-sided continuation counts for Kneser-Ney smoothing
         FreqTablesVec lr_;
+        /// @brief Words following each context, with left continuation 
+        /// counts, built if the underlying kgramFreqs has a right 
+        /// continuation index (see kgramFreqs::set_followers_index()).
+        Followers lf_;
+        bool indexed_;
 public:
         KNFreqs (const kgramFreqs & f) 
                 : f_(f), l_(f_.N()), r_(f_.N()), lr_(f_.N() - 1) { update(); } 
@@ -171,6 +648,51 @@ public:
         const FreqTablesVec & r() const { return r_; }
         const FreqTablesVec & l() const { return l_; }
         const FreqTablesVec & lr() const { return lr_; }
+        bool indexed() const { return indexed_; }
+        /// @brief Words w with non-zero left continuation count N1+(* c w)
+        /// after a context c, with this count, see Followers::query().
+        const std::vector<Follower> & l_followers(
+                size_t order, const std::string & context) const
+                { return lf_.query(order, context); }
+};
+
+/// @class KNWeights
+/// @brief Precomputed context counts for Kneser-Ney smoothing, from which 
+/// context counts and backoff factors are obtained.
+/// @details The counts only depend on the context, so that they are 
+/// computed once per context, and recomputed when the underlying k-gram 
+/// counts change. Backoff factors, which also depend on the discount, are 
+/// computed from these on lookup, so that setting the discount has no cost.
+class KNWeights : public Satellite {
+        /// @brief Counts of a context entering its ContextWeights.
+        struct Counts {
+                double den; ///< @brief Count(c) or N1+(*,c,*)
+                double N1p; ///< @brief N1+(c,*)
+        };
+        const kgramFreqs & f_;
+        const KNFreqs & knf_;
+        const double & D_;
+        /// @brief Counts of highest order term, den = Count(c)
+        ContextTablesVec<Counts> high_;
+        /// @brief Counts of continuation terms, den = N1+(*,c,*)
+        ContextTablesVec<Counts> low_;
+        
+        /// @brief Context counts and backoff factor 
+        ///      BackoffFac(c) = D * N1+(c,*) / den.
+        /// Contexts with zero counts back off the full probability mass.
+        ContextWeights weights (const Counts & c) const {
+                if (c.den == 0) return ContextWeights{0, 1};
+                return ContextWeights{c.den, D_ * c.N1p / c.den};
+        }
+public:
+        KNWeights (const kgramFreqs & f, const KNFreqs & knf, const double & D)
+                : f_(f), knf_(knf), D_(D), high_(f_.N()), low_(f_.N() - 1) 
+                { update(); }
+        void update ();
+        ContextWeights high(size_t order, const std::string & context) const
+                { return weights(high_.query(order, context)); }
+        ContextWeights low(size_t order, const std::string & context) const
+                { return weights(low_.query(order, context)); }
 };
 
 /// @class KneserNeySmoother
@@ -179,14 +701,20 @@ class KNSmoother : public Smoother {
         //--------Private variables--------//
         double D_; ///< @brief Discount
         KNFreqs knf_; ///< @brief Kneser-Ney continuation counts
+        KNWeights knw_; ///< @brief Kneser-Ney context counts and backoffs
         
-        // Compute continuation probability of word in given context
-        // k-gram order is passed 
-        double prob_cont (const std::string &, std::string, size_t) const;
+        // Compute weights and discounted probabilities of an interpolation 
+        // term. Defined in Smoothing.cpp
+        ContextWeights term (size_t, const std::string &, bool, SparseProbs &)
+                const;
 public:
         //--------Constructors--------//
         KNSmoother (kgramFreqs & f, size_t N, const double D) 
-                : Smoother(f, N), D_(D), knf_(f) { f.add_satellite(&knf_); }
+                : Smoother(f, N), D_(D), knf_(f), knw_(f, knf_, D_) 
+        { 
+                add_satellite(&knf_); 
+                add_satellite(&knw_); // Must be updated after knf_ 
+        }
         
         //--------Parameters getters/setters--------//
         double D() const { return D_; }
@@ -196,11 +724,36 @@ public:
                                         "Discount must be between 0 and 1."
                         );
                 D_ = D;
+                params_changed();
         }
         
         //--------Probabilities--------//
         // KN probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void prob_orders (int word, 
+                          const State & state, 
+                          std::vector<double> & res) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        size_t base_index (size_t order) const { return order > 0; }
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
+        
+        //--------Discount tuning--------//
+        // See score_discount_grid(). Defined in Smoothing.cpp
+        static constexpr size_t n_discounts = 1;
+        void discount_stats (int word, 
+                             const State & state, 
+                             std::vector<DiscountStats> & res) const;
+        double discounted_prob (const DiscountStats * stats, 
+                                size_t n,
+                                const double * D) const;
 }; // class KneserNeySmoother
 
 class mKNFreqs : public Satellite {
@@ -218,6 +771,10 @@ class mKNFreqs : public Satellite {
         FreqTablesVec r3plow_;
         /// @brief Two-sided continuation counts for Kneser-Ney smoothing
         FreqTablesVec lr_;
+        /// @brief Words following each context, with left continuation 
+        /// counts, see KNFreqs.
+        Followers lf_;
+        bool indexed_;
 public:
         mKNFreqs (const kgramFreqs & f) 
                 : f_(f), 
@@ -235,6 +792,50 @@ public:
         const FreqTablesVec & r3plow() const { return r3plow_; }
         const FreqTablesVec & l() const { return l_; }
         const FreqTablesVec & lr() const { return lr_; }
+        bool indexed() const { return indexed_; }
+        const std::vector<Follower> & l_followers(
+                size_t order, const std::string & context) const
+                { return lf_.query(order, context); }
+};
+
+/// @class mKNWeights
+/// @brief Precomputed context counts for modified Kneser-Ney smoothing, from
+/// which context counts and backoff factors are obtained.
+/// @details See KNWeights.
+class mKNWeights : public Satellite {
+        /// @brief Counts of a context entering its ContextWeights.
+        struct Counts {
+                double den; ///< @brief Count(c) or N1+(*,c,*)
+                /// @brief Number of words with (continuation) count 1, 2
+                /// and 3 or more after c.
+                double N1, N2, N3p;
+        };
+        const kgramFreqs & f_;
+        const mKNFreqs & mknf_;
+        const double & D1_, & D2_, & D3_;
+        /// @brief Counts of highest order term, den = Count(c)
+        ContextTablesVec<Counts> high_;
+        /// @brief Counts of continuation terms, den = N1+(*,c,*)
+        ContextTablesVec<Counts> low_;
+        
+        /// @brief Context counts and backoff factor 
+        ///      BackoffFac(c) = (D1 * N1 + D2 * N2 + D3 * N3+) / den.
+        ContextWeights weights (const Counts & c) const {
+                if (c.den == 0) return ContextWeights{0, 1};
+                double gamma = (D1_ * c.N1 + D2_ * c.N2 + D3_ * c.N3p) / c.den;
+                return ContextWeights{c.den, gamma};
+        }
+public:
+        mKNWeights (const kgramFreqs & f, const mKNFreqs & mknf, 
+                    const double & D1, const double & D2, const double & D3)
+                : f_(f), mknf_(mknf), D1_(D1), D2_(D2), D3_(D3), 
+                  high_(f_.N()), low_(f_.N() - 1) 
+                { update(); }
+        void update ();
+        ContextWeights high(size_t order, const std::string & context) const
+                { return weights(high_.query(order, context)); }
+        ContextWeights low(size_t order, const std::string & context) const
+                { return weights(low_.query(order, context)); }
 };
 
 /// @class mKNSmoother
@@ -243,24 +844,34 @@ class mKNSmoother : public Smoother {
         //--------Private variables--------//
         double D1_, D2_, D3_; ///< @brief Discount
         mKNFreqs mknf_; ///< @brief Kneser-Ney continuation counts
+        mKNWeights mknw_; ///< @brief Kneser-Ney context counts and backoffs
+        
+        // Compute weights and discounted probabilities of an interpolation 
+        // term. Defined in Smoothing.cpp
+        ContextWeights term (size_t, const std::string &, bool, SparseProbs &)
+                const;
         
-        void discount (double & count) const {
+        static void discount (double & count, double D1, double D2, double D3)
+        {
                 if (count > 2.5) // i.e. count >= 3
-                        count -= D3_;
+                        count -= D3;
                 else if (count > 1.5) // i.e. count == 2 
-                        count -= D2_;
+                        count -= D2;
                 else if (count > 0.5) // i.e. count == 1
-                        count -= D1_;
+                        count -= D1;
                 if (count < 0) count = 0;
         }
-        // Compute continuation probability of word in given context
-        // k-gram order is passed 
-        double prob_cont (const std::string &, std::string, size_t) const;
+        void discount (double & count) const 
+                { discount(count, D1_, D2_, D3_); }
 public:
         //--------Constructors--------//
         mKNSmoother (kgramFreqs & f, size_t N, double D1, double D2, double D3) 
-                : Smoother(f, N), D1_(D1), D2_(D2), D3_(D3), mknf_(f) 
-                { f.add_satellite(&mknf_); }
+                : Smoother(f, N), D1_(D1), D2_(D2), D3_(D3), mknf_(f), 
+                  mknw_(f, mknf_, D1_, D2_, D3_)
+        { 
+                add_satellite(&mknf_); 
+                add_satellite(&mknw_); // Must be updated after mknf_
+        }
         
         //--------Parameters getters/setters--------//
         double D1() const { return D1_; }
@@ -272,6 +883,7 @@ public:
                                 "Discount parameters must be between 0 and 1."
                         );
                 D1_ = D1;
+                params_changed();
         }
         void set_D2 (double D2) {
                 if (D2 < 0 or D2 > 1)
@@ -279,6 +891,7 @@ public:
                                         "Discount parameters must be between 0 and 1."
                         );
                 D2_ = D2;
+                params_changed();
         }
         void set_D3 (double D3) {
                 if (D3 < 0 or D3 > 1)
@@ -286,11 +899,36 @@ public:
                                         "Discount parameters must be between 0 and 1."
                         );
                 D3_ = D3;
+                params_changed();
         }
         
         //--------Probabilities--------//
         // KN probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void prob_orders (int word, 
+                          const State & state, 
+                          std::vector<double> & res) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        size_t base_index (size_t order) const { return order > 0; }
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
+        
+        //--------Discount tuning--------//
+        // See score_discount_grid(). Defined in Smoothing.cpp
+        static constexpr size_t n_discounts = 3;
+        void discount_stats (int word, 
+                             const State & state, 
+                             std::vector<DiscountStats> & res) const;
+        double discounted_prob (const DiscountStats * stats, 
+                                size_t n,
+                                const double * D) const;
 }; // class KneserNeySmoother
 
 
@@ -327,11 +965,14 @@ class AbsSmoother : public Smoother {
         //--------Private variables--------//
         double D_; ///< @brief Discount
         RFreqs absf_; ///< @brief Right continuation counts
-
+        
+        // Compute backoff factor and discounted probabilities of an 
+        // interpolation term. Defined in Smoothing.cpp
+        double term (size_t, const std::string &, SparseProbs &) const;
 public:
         //--------Constructors--------//
         AbsSmoother (kgramFreqs & f, size_t N, const double D) 
-                : Smoother(f, N), D_(D), absf_(f) { f.add_satellite(&absf_); }
+                : Smoother(f, N), D_(D), absf_(f) { add_satellite(&absf_); }
         
         //--------Parameters getters/setters--------//
         double D() const { return D_; }
@@ -341,11 +982,35 @@ public:
                                 "Discount must be between 0 and 1."
                         );
                 D_ = D;
+                params_changed();
         }
         
         //--------Probabilities--------//
         // KN probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void prob_orders (int word, 
+                          const State & state, 
+                          std::vector<double> & res) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
+        
+        //--------Discount tuning--------//
+        // See score_discount_grid(). Defined in Smoothing.cpp
+        static constexpr size_t n_discounts = 1;
+        void discount_stats (int word, 
+                             const State & state, 
+                             std::vector<DiscountStats> & res) const;
+        double discounted_prob (const DiscountStats * stats, 
+                                size_t n,
+                                const double * D) const;
 }; // class AbsSmoother
 
 /// @class WBSmoother
@@ -356,15 +1021,134 @@ class WBSmoother : public Smoother {
         
         //--------Private variables--------//
         RFreqs wbf_; ///< @brief Right continuation counts
-        
 public:
         //--------Constructors--------//
         WBSmoother (kgramFreqs & f, size_t N) 
-                : Smoother(f, N), wbf_(f) { f.add_satellite(&wbf_); }
+                : Smoother(f, N), wbf_(f) { add_satellite(&wbf_); }
         
         //--------Probabilities--------//
         // KN probabilities. Defined in Smoothing.cpp
-        double operator() (const std::string & word, std::string context) const;
+        ContextWeights context_weights (size_t order, const State & state) 
+                const;
+        double prob (int word, const State & state) const final;
+        void prob_orders (int word, 
+                          const State & state, 
+                          std::vector<double> & res) const final;
+        void distribution (const State & state, std::vector<double> & res) 
+                const;
+        void base_distribution (size_t order, std::vector<double> & res) 
+                const;
+        void sparse_distribution (const State & state, 
+                                  const std::vector<double> & base,
+                                  SparseProbs & probs,
+                                  double & gamma) const;
 }; // class WBSmoother
 
+/// @struct HitProfile
+/// @brief Distribution of the orders at which the words of a test corpus are
+/// found in the k-gram frequency tables, see Smoother::hit_order().
+struct HitProfile {
+        /// @brief hits[k] is the number of words whose highest order k-gram
+        /// with non-zero count has order k. For k = 0, the probability of
+        /// the word is given by the base case 1 / (V + 2) of smoothers.
+        std::vector<size_t> hits;
+        size_t oov = 0; ///< @brief Number of Out-Of-Vocabulary words
+        
+        /// @param N A positive integer. Order of the model.
+        HitProfile (size_t N) : hits(N + 1, 0) {}
+        
+        /// @brief Register a word scored in a given context state.
+        void add (const Smoother & smoother, int word, const State & state) {
+                ++hits[smoother.hit_order(word, state)];
+                if (word == UNK_ID) ++oov;
+        }
+        
+        /// @brief Add the counts of another profile.
+        void merge (const HitProfile & other) {
+                for (size_t k = 0; k < hits.size(); ++k)
+                        hits[k] += other.hits[k];
+                oov += other.oov;
+        }
+};
+
+//--------Statically dispatched kernels--------//
+
+// Sentence scoring kernels, templated on the type S of the smoother. When S
+// is a concrete smoother, whose prob() method is 'final', calls to prob() are
+// resolved at compile time and can be inlined in the scoring loops, while 
+// S = Smoother falls back to virtual dispatch. Defined in Smoothing.cpp, 
+// where they are explicitly instantiated for all smoothers.
+
+/// @brief Log-probability and number of words (including End-Of-Sentence) 
+/// of a sentence, see Smoother::operator(). If 'profile' is not null, words
+/// are also registered in the HitProfile.
+template<class S>
+std::pair<double, size_t> sentence_log_prob (const S &, 
+                                             const std::string &,
+                                             HitProfile * profile = nullptr);
+
+/// @brief Log-probabilities and word counts of a batch of sentences, see 
+/// Smoother::score_sentences().
+template<class S>
+void score_batch (const S &, 
+                  const std::vector<std::string> &, 
+                  std::vector<double> &, 
+                  std::vector<size_t> &,
+                  size_t n_threads = 1,
+                  HitProfile * profile = nullptr);
+
+/// @brief Log-probabilities and word counts of a batch of sentences, for 
+/// models of all orders up to N, see Smoother::prob_orders().
+template<class S>
+void score_batch_orders (const S &, 
+                         const std::vector<std::string> &, 
+                         std::vector<double> &, 
+                         std::vector<size_t> &,
+                         size_t n_threads = 1,
+                         HitProfile * profile = nullptr);
+
+/// @brief Total log-probability and word count of a batch of sentences, for 
+/// each point of a grid of discounts. Defined for KNSmoother, mKNSmoother and
+/// AbsSmoother, see score_discount_grid() in Smoothing.cpp.
+template<class S>
+void score_discount_grid (const S &, 
+                          const std::vector<std::string> &,
+                          const std::vector<std::vector<double>> &,
+                          std::vector<double> &, 
+                          size_t &,
+                          size_t n_threads = 1);
+
+/// @struct SentenceScores
+/// @brief Log-probabilities and word counts of individual sentences, see 
+/// score_stream().
+struct SentenceScores {
+        std::vector<std::string> sentence;
+        std::vector<double> log_prob;
+        std::vector<size_t> n_words;
+};
+
+/// @brief Total log-probability and word count of the text read from a 
+/// stream, optionally with the scores of individual sentences, see
+/// score_stream() in Smoothing.cpp.
+template<class S>
+double score_stream (const S &, 
+                     std::istream &,
+                     const TextProcessor &,
+                     size_t &,
+                     size_t batch_size,
+                     size_t n_threads = 1,
+                     SentenceScores * details = nullptr,
+                     HitProfile * profile = nullptr);
+
+/// @brief Total log-probability and word count of an encoded corpus, 
+/// optionally with the scores of individual sentences, see score_encoded() 
+/// in Smoothing.cpp.
+template<class S>
+double score_encoded (const S &, 
+                      const EncodedCorpus &,
+                      size_t &,
+                      size_t n_threads = 1,
+                      SentenceScores * details = nullptr,
+                      HitProfile * profile = nullptr);
+
 #endif //SMOOTHING_H
\ No newline at end of file
@@ -2,112 +2,130 @@
 
 //---------------- Models ----------------//
 
-// TODO: Is it possible to avoid the abomination below using either templates 
-// or virtual methods? 
-
-class SBOSmootherR : public SBOSmoother {
+/// @class SmootherR
+/// @brief R interface of a smoother of type S.
+/// @details The methods exposed to R are the same for all smoothers, and are
+/// implemented by the generic functions of SmoothingR.h. Sentence scoring is
+/// statically dispatched to S, see score_batch().
+template<class S>
+class SmootherR : public S {
 public:
-        SBOSmootherR (const kgramFreqsR & f, size_t N, const double lambda) 
-                : SBOSmoother(f, N, lambda) {}
+        /// @brief Forward arguments to the constructor of S.
+        template<class... Args>
+        SmootherR (kgramFreqsR & f, Args... args) : S(f, args...) {}
         NumericVector probability (CharacterVector word, std::string context) 
                 { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-                { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-                { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-                { return sample_generic(this, n, max_length, T); }
-}; // class SBOSmootherR
-
-class AddkSmootherR : public AddkSmoother {
-public:
-        AddkSmootherR (const kgramFreqsR & f, size_t N, const double k) 
-                : AddkSmoother(f, N, k) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-                { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-                { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-                { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-                { return sample_generic(this, n, max_length, T); }
-}; // class AddkSmootherR
-
-class MLSmootherR : public MLSmoother {
-public:
-        MLSmootherR (const kgramFreqsR & f, size_t N) 
-                : MLSmoother(f, N) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-        { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-        { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-        { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-        { return sample_generic(this, n, max_length, T); }
-}; // class AddkSmootherR
-
-class KNSmootherR : public KNSmoother {
-public:
-        KNSmootherR (kgramFreqsR & f, size_t N, const double D) 
-                : KNSmoother(f, N, D) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-        { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-        { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-        { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-        { return sample_generic(this, n, max_length, T); }
-}; // class KNSmootherR
-
-class mKNSmootherR : public mKNSmoother {
-public:
-        mKNSmootherR (kgramFreqsR & f, size_t N, double D1, double D2, double D3) 
-                : mKNSmoother(f, N, D1, D2, D3) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-        { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-        { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-        { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-        { return sample_generic(this, n, max_length, T); }
-}; // class KNSmootherR
+        NumericVector probability_ids (IntegerVector word, 
+                                       IntegerMatrix context) 
+                { return probability_ids_generic(this, word, context); }
+        NumericVector distribution (std::string context) 
+                { return distribution_generic(this, context); }
+        NumericVector top_k (std::string context, size_t k) 
+                { return top_k_generic(this, context, k); }
+        NumericVector probability_sentence (CharacterVector sentence, 
+                                            size_t n_threads) 
+                { return probability_generic<S>(this, sentence, n_threads); }
+        List log_probability_sentence (CharacterVector sentence, 
+                                       size_t n_threads,
+                                       bool detailed) 
+                { 
+                        return log_prob_generic<S>(
+                                this, sentence, n_threads, detailed
+                                ); 
+                }
+        List log_probability_sentence_orders (CharacterVector sentence, 
+                                              size_t n_threads,
+                                              bool detailed) 
+                { 
+                        return log_prob_orders_generic<S>(
+                                this, sentence, n_threads, detailed
+                                ); 
+                }
+        List log_probability_file (std::string path, 
+                                   std::string erase, 
+                                   bool lower_case,
+                                   bool tknz,
+                                   std::string EOS, 
+                                   bool keep_first,
+                                   size_t batch_size,
+                                   size_t n_threads,
+                                   bool detailed) 
+                {
+                        return log_prob_file_generic<S>(
+                                this, path, erase, lower_case, tknz, EOS, 
+                                keep_first, batch_size, n_threads, detailed
+                                );
+                }
+        List log_probability_encoded (std::string path, 
+                                      size_t n_threads,
+                                      bool detailed) 
+                {
+                        return log_prob_encoded_generic<S>(
+                                this, path, n_threads, detailed
+                                );
+                }
+        CharacterVector sample (size_t n, 
+                                size_t max_length, 
+                                double T, 
+                                size_t top_k,
+                                double top_p,
+                                size_t n_threads) 
+                { 
+                        return sample_generic(
+                                this, n, max_length, T, top_k, top_p, n_threads
+                                ); 
+                }
+        List complete (std::string prefix, 
+                       size_t width, 
+                       size_t n_best, 
+                       size_t max_length, 
+                       double alpha) 
+                { 
+                        return complete_generic(
+                                this, prefix, width, n_best, max_length, alpha
+                                ); 
+                }
+}; // class SmootherR
 
-class AbsSmootherR : public AbsSmoother {
-public:
-        AbsSmootherR (kgramFreqsR & f, size_t N, const double D) 
-                : AbsSmoother(f, N, D) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-        { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-        { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-        { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-        { return sample_generic(this, n, max_length, T); }
-}; // class AbsSmootherR
-
-class WBSmootherR : public WBSmoother {
-public:
-        WBSmootherR (kgramFreqsR & f, size_t N) 
-                : WBSmoother(f, N) {}
-        NumericVector probability (CharacterVector word, std::string context) 
-        { return probability_generic(this, word, context); }
-        NumericVector probability_sentence (CharacterVector sentence) 
-        { return probability_generic(this, sentence); }
-        List log_probability_sentence (CharacterVector sentence) 
-        { return log_prob_generic(this, sentence); }
-        CharacterVector sample (size_t n, size_t max_length, double T = 1.0) 
-        { return sample_generic(this, n, max_length, T); }
-}; // class AbsSmootherR
+/// @brief Expose SmootherR<S> to R, under the given name.
+/// @param name Name of the class in R.
+/// @param base Name of the class exposing S to R.
+/// @details 'Args' are the types of the parameters of S, passed to the 
+/// constructor after the kgramFreqsR object and the order N.
+template<class S, class... Args>
+void expose_smoother (const char * name, const char * base) {
+        using T = SmootherR<S>;
+        class_<T>(name)
+                .template derives<S>(base)
+                .template constructor<kgramFreqsR&, size_t, Args...>()
+                .method("probability", &T::probability)
+                .method("probability_ids", &T::probability_ids)
+                .method("distribution", &T::distribution)
+                .method("top_k", &T::top_k)
+                .method("probability_sentence", &T::probability_sentence)
+                .method("log_probability_sentence", &T::log_probability_sentence)
+                .method("log_probability_sentence_orders", 
+                        &T::log_probability_sentence_orders)
+                .method("log_probability_file", &T::log_probability_file)
+                .method("log_probability_encoded", 
+                        &T::log_probability_encoded)
+                .method("sample", &T::sample)
+                .method("complete", &T::complete)
+        ;
+}
 
 RCPP_EXPOSED_CLASS(kgramFreqsR)
 RCPP_MODULE (Smoothing) {
         class_<Smoother>("___Smoother")
                 .property("N", &Smoother::N, &Smoother::set_N)
                 .property("V", &Smoother::V)
+                .property("cache_capacity", &Smoother::cache_capacity, &Smoother::set_cache_capacity)
+                .property("cache_size", &Smoother::cache_size)
+                .property("cache_hits", &Smoother::cache_hits)
+                .property("cache_misses", &Smoother::cache_misses)
+                .method("clear_cache", &Smoother::clear_cache)
+                .const_method("resolved", &Smoother::resolved)
+                .method("reset_stats", &Smoother::reset_stats)
         ;
         class_<SBOSmoother>("___SBOSmoother")
                 .derives<Smoother>("___Smoother")
@@ -123,74 +141,33 @@ RCPP_MODULE (Smoothing) {
         class_<KNSmoother>("___KNSmoother")
                 .derives<Smoother>("___Smoother")
                 .property("D", &KNSmoother::D, &KNSmoother::set_D)
+                .method("log_probability_grid", 
+                        &log_prob_grid_generic<KNSmoother>)
         ;
         class_<mKNSmoother>("___mKNSmoother")
                 .derives<Smoother>("___Smoother")
                 .property("D1", &mKNSmoother::D1, &mKNSmoother::set_D1)
                 .property("D2", &mKNSmoother::D2, &mKNSmoother::set_D2)
                 .property("D3", &mKNSmoother::D3, &mKNSmoother::set_D3)
+                .method("log_probability_grid", 
+                        &log_prob_grid_generic<mKNSmoother>)
         ;
         class_<AbsSmoother>("___AbsSmoother")
                 .derives<Smoother>("___Smoother")
                 .property("D", &AbsSmoother::D, &AbsSmoother::set_D)
+                .method("log_probability_grid", 
+                        &log_prob_grid_generic<AbsSmoother>)
         ;
         class_<WBSmoother>("___WBSmoother")
                 .derives<Smoother>("___Smoother")
         ;
-        class_<SBOSmootherR>("SBOSmoother")
-                .derives<SBOSmoother>("___SBOSmoother")
-                .constructor<const kgramFreqsR&, size_t, const double>()
-                .method("probability", &SBOSmootherR::probability)
-                .method("probability_sentence", &SBOSmootherR::probability_sentence)
-                .method("log_probability_sentence", &SBOSmootherR::log_probability_sentence)
-                .method("sample", &SBOSmootherR::sample)
-        ;
-        class_<MLSmootherR>("MLSmoother")
-                .derives<MLSmoother>("___MLSmoother")
-                .constructor<const kgramFreqsR&,size_t>()
-                .method("probability", &MLSmootherR::probability)
-                .method("probability_sentence", &MLSmootherR::probability_sentence)
-                .method("log_probability_sentence", &MLSmootherR::log_probability_sentence)
-                .method("sample", &MLSmootherR::sample)
-        ;
-        class_<AddkSmootherR>("AddkSmoother")
-                .derives<AddkSmoother>("___AddkSmoother")
-                .constructor<const kgramFreqsR&, size_t, const double>()
-                .method("probability", &AddkSmootherR::probability)
-                .method("probability_sentence", &AddkSmootherR::probability_sentence)
-                .method("log_probability_sentence", &AddkSmootherR::log_probability_sentence)
-                .method("sample", &AddkSmootherR::sample)
-        ;
-        class_<KNSmootherR>("KNSmoother")
-                .derives<KNSmoother>("___KNSmoother")
-                .constructor<kgramFreqsR&, size_t, const double>()
-                .method("probability", &KNSmootherR::probability)
-                .method("probability_sentence", &KNSmootherR::probability_sentence)
-                .method("log_probability_sentence", &KNSmootherR::log_probability_sentence)
-                .method("sample", &KNSmootherR::sample)
-        ;
-        class_<mKNSmootherR>("mKNSmoother")
-                .derives<mKNSmoother>("___mKNSmoother")
-                .constructor<kgramFreqsR&, size_t, double, double, double>()
-                .method("probability", &mKNSmootherR::probability)
-                .method("probability_sentence", &mKNSmootherR::probability_sentence)
-                .method("log_probability_sentence", &mKNSmootherR::log_probability_sentence)
-                .method("sample", &mKNSmootherR::sample)
-        ;
-        class_<AbsSmootherR>("AbsSmoother")
-                .derives<AbsSmoother>("___AbsSmoother")
-                .constructor<kgramFreqsR&, size_t, const double>()
-                .method("probability", &AbsSmootherR::probability)
-                .method("probability_sentence", &AbsSmootherR::probability_sentence)
-                .method("log_probability_sentence", &AbsSmootherR::log_probability_sentence)
-                .method("sample", &AbsSmootherR::sample)
-        ;
-        class_<WBSmootherR>("WBSmoother")
-                .derives<WBSmoother>("___WBSmoother")
-                .constructor<kgramFreqsR&, size_t>()
-                .method("probability", &WBSmootherR::probability)
-                .method("probability_sentence", &WBSmootherR::probability_sentence)
-                .method("log_probability_sentence", &WBSmootherR::log_probability_sentence)
-                .method("sample", &WBSmootherR::sample)
-        ;
+        expose_smoother<SBOSmoother, double>("SBOSmoother", "___SBOSmoother");
+        expose_smoother<AddkSmoother, double>("AddkSmoother", "___AddkSmoother");
+        expose_smoother<MLSmoother>("MLSmoother", "___MLSmoother");
+        expose_smoother<KNSmoother, double>("KNSmoother", "___KNSmoother");
+        expose_smoother<mKNSmoother, double, double, double>(
+                "mKNSmoother", "___mKNSmoother"
+                );
+        expose_smoother<AbsSmoother, double>("AbsSmoother", "___AbsSmoother");
+        expose_smoother<WBSmoother>("WBSmoother", "___WBSmoother");
 }
\ No newline at end of file
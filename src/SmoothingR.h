@@ -6,87 +6,70 @@
 #define SMOOTHING_R_H
 
 #include "Smoothing.h"
+#include "Sampler.h"
+#include "BeamSearch.h"
 #include "kgramFreqsR.h"
 #include <Rmath.h>
+#include <fstream>
 #include <Rcpp.h>
 using namespace Rcpp;
 
-// Not implemented. Sampling words using simple rejection method.
-// N.B.: requires normalized probabilities.
-//
-// std::string sample_word_rej(std::string context) {
-//         std::string res;
-//         double best = 0, tmp;
-//         std::string word;
-//         while (true) {
-//                 size_t n = R::runif(0, prob_.V_);
-//                 word = prob_.f_.dictionary()->word(std::to_string(n));
-//                 if (prob_(word, context) / R::runif(0, 1) > 1)
-//                         return word;
-//         }
-// }
-
-std::string sample_word_generic (Smoother * smoother, 
-                                 std::string context, 
-                                 double T = 1.0)
+// Sentences are sampled natively in parallel, see Sampler::sentences(). The
+// seed of the random streams is drawn from R's random number generator. 
+// Sampling is truncated if top_k > 0 or top_p < 1, see Sampler::candidates().
+CharacterVector sample_generic (Smoother * smoother,
+                                size_t n,
+                                size_t max_length, 
+                                double T = 1.0,
+                                size_t top_k = 0,
+                                double top_p = 1.0,
+                                size_t n_threads = 1)
 {
-        std::string res;
-        double best = 0, tmp;
-        std::string word;
-        // Sample word from P(word|context) using Gumbel-Max trick
-        for (size_t i = 1; i <= smoother->V(); ++i) {
-                word = smoother->word(std::to_string(i));
-                tmp = smoother->operator()(word, context);
-                tmp = std::pow(tmp, 1 / T);
-                tmp /= R::rexp(1.);
-                if (tmp > best) {
-                        best = tmp;
-                        res = word;
-                }
+        uint64_t seed;
+        {
+                RNGScope scope;
+                uint64_t hi = R::unif_rand() * 4294967296.0;
+                uint64_t lo = R::unif_rand() * 4294967296.0;
+                seed = (hi << 32) | lo;
         }
-        // Separate iteration for EOS token
-        tmp = smoother->operator()(EOS_TOK, context);
-        tmp = std::pow(tmp, 1 / T);
-        tmp /= R::rexp(1.);
-        if (tmp > best)
-                res = EOS_TOK;
-        // N.B.: we forbid sampling the UNK token
-        return res;
+        // Base distributions are computed only once for all sentences
+        Sampler sampler(*smoother, T, top_k, top_p);
+        std::vector<std::string> res;
+        sampler.sentences(n, max_length, seed, n_threads, res);
+        return wrap(res);
 }
 
-std::string sample_sentence_generic (Smoother * smoother, 
-                                     size_t max_length, 
-                                     double T = 1.0)
+// Best completions of a sentence prefix, see BeamSearch.
+List complete_generic (Smoother * smoother,
+                       std::string prefix,
+                       size_t width,
+                       size_t n_best,
+                       size_t max_length,
+                       double alpha)
 {
-        std::string res = "", context = "";
-        for (size_t i = 1; i < smoother->N(); ++i) {
-                context += BOS_TOK + " ";
-        }
-        size_t n_words = 0;
-        std::string new_word; size_t start = 0;
-        while (n_words < max_length) {
-                n_words++;
-                new_word = sample_word_generic(smoother, context, T);
-                if (new_word == EOS_TOK) 
-                        return res + "<EOS>";
-                res += new_word + " ";
-                context += " " + new_word;
-                start = context.find_first_not_of(" ");
-                start = context.find_first_of(" ", start);
-                context = context.substr(start + 1);
+        std::vector<Completion> completions;
+        BeamSearch(*smoother, width, alpha)(
+                prefix, max_length, n_best, completions
+                );
+        size_t len = completions.size();
+        CharacterVector completion(len);
+        NumericVector log_prob(len), score(len);
+        LogicalVector complete(len);
+        for (size_t i = 0; i < len; ++i) {
+                std::string words = "";
+                for (int id : completions[i].words) {
+                        if (not words.empty()) words += " ";
+                        words += smoother->word(id);
+                }
+                completion[i] = words;
+                log_prob[i] = completions[i].log_prob;
+                score[i] = completions[i].score;
+                complete[i] = completions[i].complete;
         }
-        return res + "[...] (truncated output)";     
-}
-
-CharacterVector sample_generic (Smoother * smoother,
-                                size_t n,
-                                size_t max_length, 
-                                double T = 1.0)
-{
-        CharacterVector res(n);
-        for (size_t i = 0; i < n; ++i)
-                res[i] = sample_sentence_generic(smoother, max_length, T);
-        return res;
+        return List::create(_["completion"] = completion,
+                            _["log_prob"] = log_prob,
+                            _["score"] = score,
+                            _["complete"] = complete);
 }
 
 NumericVector probability_generic (Smoother * smoother,
@@ -97,43 +80,286 @@ NumericVector probability_generic (Smoother * smoother,
         size_t len = word.length();
         NumericVector res(len);
         std::string tmp;
+        // Context state is computed only once for all words (or retrieved 
+        // from the context cache)
+        State state = smoother->context(context);
         for (size_t i = 0; i < len; ++i) {
                 tmp = word[i];
-                res[i] = smoother->operator()(tmp, context);
+                res[i] = smoother->operator()(tmp, state);
                 if (res[i] == -1) res[i] = NA_REAL;
         }
         return res;
 }
 
-NumericVector probability_generic(Smoother * smoother, 
-                                  CharacterVector sentence) 
+// Continuation probabilities of word IDs, given contexts of word IDs, one 
+// per row of 'context' (NA entries being skipped). A context with a single
+// row is shared by all words. The state of each context is computed once for
+// all consecutive rows containing it, without any string processing.
+NumericVector probability_ids_generic (Smoother * smoother,
+                                       IntegerVector word,
+                                       IntegerMatrix context
+) 
 {
-        size_t len = sentence.length();
+        size_t len = word.length(), m = context.ncol();
+        bool shared = context.nrow() == 1;
         NumericVector res(len);
-        std::string tmp;
+        std::vector<int> ids, last;
+        State state;
         for (size_t i = 0; i < len; ++i) {
-                tmp = sentence[i];
-                res[i] = smoother->operator()(tmp).first;
-                        if (res[i] == -1) res[i] = NA_REAL;
+                size_t row = shared ? 0 : i;
+                ids.clear();
+                for (size_t j = 0; j < m; ++j)
+                        if (context(row, j) != NA_INTEGER) 
+                                ids.push_back(context(row, j));
+                if (i == 0 or ids != last) {
+                        state = smoother->state(ids);
+                        smoother->resolve(state);
+                        last = ids;
+                }
+                res[i] = smoother->prob(word[i], state);
+                if (res[i] == -1) res[i] = NA_REAL;
+        }
+        return res;
+}
+
+NumericVector distribution_generic (Smoother * smoother, std::string context)
+{
+        std::vector<double> dist;
+        smoother->distribution(smoother->context(context), dist);
+        size_t len = dist.size();
+        NumericVector res(len);
+        CharacterVector words(len);
+        for (size_t i = 0; i < len; ++i) {
+                res[i] = dist[i];
+                if (res[i] == -1) res[i] = NA_REAL;
+                words[i] = smoother->word(smoother->dense_id(i));
+        }
+        res.names() = words;
+        return res;
+}
+
+NumericVector top_k_generic (Smoother * smoother, 
+                             std::string context, 
+                             size_t k)
+{
+        State state = smoother->context(context);
+        SparseProbs top;
+        smoother->top_k(state, k, top);
+        size_t len = top.size();
+        NumericVector res(len);
+        CharacterVector words(len);
+        for (size_t i = 0; i < len; ++i) {
+                // Same values as probability()
+                res[i] = smoother->prob(top[i].first, state);
+                if (res[i] == -1) res[i] = NA_REAL;
+                words[i] = smoother->word(top[i].first);
         }
+        res.names() = words;
         return res;
 }
 
-List log_prob_generic(Smoother * smoother, CharacterVector sentence) 
+// Sentence scoring is statically dispatched to the smoother type S, see 
+// score_batch()
+template<class S>
+NumericVector probability_generic(const S * smoother, 
+                                  CharacterVector sentence,
+                                  size_t n_threads = 1) 
 {
         size_t len = sentence.length();
+        std::vector<std::string> sentences(len);
+        for (size_t i = 0; i < len; ++i) 
+                sentences[i] = sentence[i];
+        std::vector<double> log_prob; std::vector<size_t> n_words;
+        score_batch(*smoother, sentences, log_prob, n_words, n_threads);
+        
+        NumericVector res(len);
+        for (size_t i = 0; i < len; ++i) 
+                res[i] = std::exp(log_prob[i]);
+        return res;
+}
+
+// Append the hit order counts and number of Out-Of-Vocabulary words of a
+// HitProfile to a list, as elements "hits" and "n_oov".
+inline void append_hit_profile(List & res, const HitProfile & profile) {
+        size_t len = profile.hits.size();
+        NumericVector hits(len);
+        for (size_t k = 0; k < len; ++k)
+                hits[k] = profile.hits[k];
+        res["hits"] = hits;
+        res["n_oov"] = (double)profile.oov;
+}
+
+// If 'detailed' is true, the output also contains the hit profile of the 
+// words of 'sentence', see HitProfile.
+template<class S>
+List log_prob_generic(const S * smoother, 
+                      CharacterVector sentence, 
+                      size_t n_threads = 1,
+                      bool detailed = false) 
+{
+        size_t len = sentence.length();
+        std::vector<std::string> sentences(len);
+        for (size_t i = 0; i < len; ++i) 
+                sentences[i] = sentence[i];
+        std::vector<double> lp; std::vector<size_t> nw;
+        HitProfile profile(smoother->N());
+        score_batch(*smoother, sentences, lp, nw, n_threads, 
+                    detailed ? &profile : nullptr);
+        
         NumericVector log_prob(len);
         IntegerVector n_words(len);
-        std::string tmp_sent;
-        std::pair<double, size_t> tmp_res;
         for (size_t i = 0; i < len; ++i) {
-                tmp_sent = sentence[i];
-                tmp_res = smoother->operator()(tmp_sent, true);
-                log_prob[i] = tmp_res.first;
-                n_words[i] = tmp_res.second;
-                if (std::isnan(tmp_res.first)) log_prob[i] = NA_REAL;
+                log_prob[i] = lp[i];
+                n_words[i] = nw[i];
+                if (std::isnan(lp[i])) log_prob[i] = NA_REAL;
+        }
+        List res = List::create(_["log_prob"] = log_prob, 
+                                _["n_words"] = n_words);
+        if (detailed)
+                append_hit_profile(res, profile);
+        return res;
+}
+
+// Log-probabilities for models of all orders up to N: column k of 'log_prob'
+// corresponds to order k + 1. If 'detailed' is true, the output also contains
+// the hit profile for the model of order N.
+template<class S>
+List log_prob_orders_generic(const S * smoother, 
+                             CharacterVector sentence, 
+                             size_t n_threads = 1,
+                             bool detailed = false) 
+{
+        size_t len = sentence.length(), N = smoother->N();
+        std::vector<std::string> sentences(len);
+        for (size_t i = 0; i < len; ++i) 
+                sentences[i] = sentence[i];
+        std::vector<double> lp; std::vector<size_t> nw;
+        HitProfile profile(N);
+        score_batch_orders(*smoother, sentences, lp, nw, n_threads,
+                           detailed ? &profile : nullptr);
+        
+        NumericMatrix log_prob(len, N);
+        IntegerVector n_words(len);
+        for (size_t i = 0; i < len; ++i) {
+                n_words[i] = nw[i];
+                for (size_t k = 0; k < N; ++k) {
+                        log_prob(i, k) = lp[i * N + k];
+                        if (std::isnan(lp[i * N + k])) 
+                                log_prob(i, k) = NA_REAL;
+                }
         }
-        return List::create(_["log_prob"] = log_prob, _["n_words"] = n_words);
+        List res = List::create(_["log_prob"] = log_prob, 
+                                _["n_words"] = n_words);
+        if (detailed)
+                append_hit_profile(res, profile);
+        return res;
+}
+
+// Total log-probability and number of words of a corpus, optionally with the
+// scores of individual sentences and the hit profile of words, as returned 
+// by log_prob_file_generic() and log_prob_encoded_generic().
+inline List corpus_scores_list(double lp, 
+                               size_t nw,
+                               const SentenceScores & details,
+                               const HitProfile & profile,
+                               bool detailed)
+{
+        List res = List::create(
+                _["log_prob"] = std::isnan(lp) ? NA_REAL : lp, 
+                _["n_words"] = (double)nw
+                );
+        if (not detailed)
+                return res;
+        
+        size_t len = details.sentence.size();
+        CharacterVector sentence(len);
+        NumericVector log_prob(len);
+        IntegerVector n_words(len);
+        for (size_t i = 0; i < len; ++i) {
+                sentence[i] = details.sentence[i];
+                log_prob[i] = details.log_prob[i];
+                n_words[i] = details.n_words[i];
+                if (std::isnan(log_prob[i])) log_prob[i] = NA_REAL;
+        }
+        res["sentence"] = sentence;
+        res["sentence_log_prob"] = log_prob;
+        res["sentence_n_words"] = n_words;
+        append_hit_profile(res, profile);
+        return res;
+}
+
+// Total log-probability of the text contained in a file, optionally with 
+// the scores of individual sentences and the hit profile of words, see 
+// score_stream(). Preprocessing and 
+// sentence tokenization are performed natively, see TextProcessor.
+template<class S>
+List log_prob_file_generic(const S * smoother,
+                           std::string path,
+                           std::string erase,
+                           bool lower_case,
+                           bool tknz,
+                           std::string EOS,
+                           bool keep_first,
+                           size_t batch_size,
+                           size_t n_threads,
+                           bool detailed)
+{
+        std::ifstream in(path);
+        if (not in)
+                stop("Could not open file '" + path + "'.");
+        TextProcessor process(erase, lower_case, tknz, EOS, keep_first);
+        SentenceScores details;
+        HitProfile profile(smoother->N());
+        size_t nw;
+        double lp = score_stream(*smoother, in, process, nw, batch_size, 
+                                 n_threads, 
+                                 detailed ? &details : nullptr,
+                                 detailed ? &profile : nullptr);
+        return corpus_scores_list(lp, nw, details, profile, detailed);
+}
+
+// Total log-probability of an encoded corpus, optionally with the scores of 
+// individual sentences and the hit profile of words, see score_encoded().
+template<class S>
+List log_prob_encoded_generic(const S * smoother,
+                              std::string path,
+                              size_t n_threads,
+                              bool detailed)
+{
+        EncodedCorpus corpus(path);
+        SentenceScores details;
+        HitProfile profile(smoother->N());
+        size_t nw;
+        double lp = score_encoded(*smoother, corpus, nw, n_threads, 
+                                  detailed ? &details : nullptr,
+                                  detailed ? &profile : nullptr);
+        return corpus_scores_list(lp, nw, details, profile, detailed);
+}
+
+// Log-probabilities for a grid of discounts, see score_discount_grid(). Each 
+// row of 'grid' contains the discounts of a grid point.
+template<class S>
+List log_prob_grid_generic(S * smoother, 
+                           CharacterVector sentence, 
+                           NumericMatrix grid,
+                           size_t n_threads) 
+{
+        size_t len = sentence.length();
+        std::vector<std::string> sentences(len);
+        for (size_t i = 0; i < len; ++i) 
+                sentences[i] = sentence[i];
+        size_t n_points = grid.nrow(), n_discounts = grid.ncol();
+        std::vector<std::vector<double>> discounts(n_points);
+        for (size_t g = 0; g < n_points; ++g) 
+                for (size_t j = 0; j < n_discounts; ++j)
+                        discounts[g].push_back(grid(g, j));
+        std::vector<double> lp; size_t nw;
+        score_discount_grid(*smoother, sentences, discounts, lp, nw, n_threads);
+        
+        NumericVector log_prob(n_points);
+        for (size_t g = 0; g < n_points; ++g) 
+                log_prob[g] = lp[g];
+        return List::create(_["log_prob"] = log_prob, _["n_words"] = nw);
 }
 
 #endif //SMOOTHING_R_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "TextProcessor.h"
+
+size_t tknz_sent(std::string & line, 
+                 std::vector<std::string> & line_res,
+                 const std::regex& _EOS,
+                 bool keep_first
+                 )
+{
+        auto itstart = std::sregex_iterator(line.begin(), line.end(), _EOS);
+        auto itend = std::sregex_iterator();
+        
+        size_t start = line.find_first_not_of(" "), end;
+        if (start == std::string::npos)
+                return 0;
+        
+        std::string tmp;
+        for (std::sregex_iterator it = itstart; it != itend; ++it) {
+                std::smatch m = *it;
+                end = m.position();
+                line_res.push_back(
+                        keep_first ?
+                line.substr(start, end - start) + " " + line[end] :
+                        line.substr(start, end - start)
+                );
+                start = line.find_first_not_of(" ", end + m.length());
+        }
+        
+        if (start != std::string::npos)
+                line_res.push_back(line.substr(start));
+        
+        return line_res.size();
+}
+
+/// @details Sentences are trimmed, and empty sentences dropped, as in 
+/// tknz_sent() in R. If sentence tokenization is disabled, the preprocessed
+/// line is appended as is.
+void TextProcessor::operator() (std::string & line, 
+                                std::vector<std::string> & sentences) const
+{
+        preprocess(line);
+        if (not tknz_) {
+                sentences.push_back(line);
+                return;
+        }
+        
+        std::vector<std::string> tmp;
+        if (split_)
+                tknz_sent(line, tmp, EOS_re_, keep_first_);
+        else
+                tmp.push_back(line);
+        
+        const char * ws = " \t\r\n";
+        for (const std::string & s : tmp) {
+                size_t start = s.find_first_not_of(ws);
+                if (start == std::string::npos)
+                        continue;
+                size_t end = s.find_last_not_of(ws);
+                sentences.push_back(s.substr(start, end - start + 1));
+        }
+}
@@ -0,0 +1,77 @@
+/// @file   TextProcessor.h
+/// @brief  Definition of TextProcessor class
+/// @author Valerio Gherardi
+
+#ifndef TEXT_PROCESSOR_H
+#define TEXT_PROCESSOR_H
+
+#include <string>
+#include <vector>
+#include <regex>
+
+/// @brief Split a line of text into sentences, see tknz_sent() in R.
+/// @param line A string. Text to be tokenized.
+/// @param line_res A vector of strings. Sentences are appended to this vector.
+/// @param _EOS A regular expression matching End-Of-Sentence punctuation.
+/// @param keep_first true or false. Whether to keep the first End-Of-Sentence
+/// character at the end of each sentence.
+/// @return The size of line_res after tokenization.
+size_t tknz_sent(std::string & line,
+                 std::vector<std::string> & line_res,
+                 const std::regex & _EOS,
+                 bool keep_first
+                 );
+
+/// @class TextProcessor
+/// @brief Native equivalent of the R preprocessing and sentence tokenization
+/// step .tknz_sent(.preprocess(text)), when .preprocess and .tknz_sent are
+/// the kgrams::preprocess() and kgrams::tknz_sent() utilities, or identity.
+/// @details A TextProcessor is not modified by processing text, and can be
+/// safely shared among threads. As the C++ preprocessing utilities of R, it
+/// is not used on Windows, where std::regex is not reliable (see 
+/// perplexity_file() in R).
+class TextProcessor {
+        bool erase_;
+        std::regex erase_re_;
+        bool lower_case_;
+        bool tknz_;
+        bool split_;
+        std::regex EOS_re_;
+        bool keep_first_;
+public:
+        /// @param erase A string. Regular expression passed to preprocess().
+        /// If empty, no character is erased.
+        /// @param lower_case true or false. Passed to preprocess().
+        /// @param tknz true or false. Whether to perform sentence
+        /// tokenization. If false, each line is a sentence.
+        /// @param EOS A string. Regular expression passed to tknz_sent().
+        /// @param keep_first true or false. Passed to tknz_sent().
+        TextProcessor (std::string erase,
+                       bool lower_case,
+                       bool tknz,
+                       std::string EOS,
+                       bool keep_first)
+                : erase_(erase != ""),
+                  erase_re_(erase),
+                  lower_case_(lower_case),
+                  tknz_(tknz),
+                  split_(EOS != ""),
+                  EOS_re_(EOS),
+                  keep_first_(keep_first)
+        {}
+
+        /// @brief Preprocess a line of text in place, see preprocess() in R.
+        void preprocess (std::string & line) const {
+                if (erase_) line = std::regex_replace(line, erase_re_, "");
+                if (lower_case_) for (char & c : line) c = tolower(c);
+        }
+
+        /// @brief Preprocess and tokenize a line of text.
+        /// @param line A string. Line of text, modified by preprocessing.
+        /// @param sentences A vector of strings. Sentences are appended to
+        /// this vector.
+        void operator() (std::string & line,
+                         std::vector<std::string> & sentences) const;
+}; // TextProcessor
+
+#endif // TEXT_PROCESSOR_H
@@ -2,6 +2,7 @@
 #include <string>
 #include <regex>
 #include <Rcpp.h>
+#include "TextProcessor.h"
 
 using namespace Rcpp;
 
@@ -26,10 +27,6 @@ CharacterVector preprocess_cpp(
         return input;
 }
 
-size_t tknz_sent(
-                std::string &, std::vector<std::string> &, const std::regex &, bool
-);
-
 // [[Rcpp::export]]
 Rcpp::CharacterVector tknz_sent_cpp(Rcpp::CharacterVector input,
                                     std::string EOS = "[.?!:;]+",
@@ -61,34 +58,3 @@ Rcpp::CharacterVector tknz_sent_cpp(Rcpp::CharacterVector input,
         
         return res;
 }
-
-size_t tknz_sent(std::string & line, 
-                 std::vector<std::string> & line_res,
-                 const std::regex& _EOS,
-                 bool keep_first
-                 )
-{
-        auto itstart = std::sregex_iterator(line.begin(), line.end(), _EOS);
-        auto itend = std::sregex_iterator();
-        
-        size_t start = line.find_first_not_of(" "), end;
-        if (start == std::string::npos)
-                return 0;
-        
-        std::string tmp;
-        for (std::sregex_iterator it = itstart; it != itend; ++it) {
-                std::smatch m = *it;
-                end = m.position();
-                line_res.push_back(
-                        keep_first ?
-                line.substr(start, end - start) + " " + line[end] :
-                        line.substr(start, end - start)
-                );
-                start = line.find_first_not_of(" ", end + m.length());
-        }
-        
-        if (start != std::string::npos)
-                line_res.push_back(line.substr(start));
-        
-        return line_res.size();
-}
@@ -1,4 +1,5 @@
 #include "kgramFreqs.h"
+#include <cstdlib>
 
 // Note: the 'prefixes' buffer is supposed to be passed by value from
 // process_sentences(), in order to reinitialize it to <BOS> <BOS> ... <BOS> 
@@ -7,33 +8,47 @@
 void kgramFreqs::process_sentence(const std::string & sentence,
                                   bool fixed_dictionary)
 {
+        ScopedTimer timer(stats_.process_ns);
         CircularBuffer<std::string> prefixes = padding_;
         WordStream stream(sentence);
-        std::string word, prefix;
+        std::string word;
         while (not stream.eos()) {
-                ++freqs_[0][""]; // Increase total words count
                 word = stream.pop_word();
                 
                 if ((not dict_.contains(word)) & (not fixed_dictionary))
                         dict_.insert(word);
                 
                 word = dict_.index(word); // UNK_TOK if 'word' not in dictionary
-                
-                // Increase k-gram counts for (k>1)-grams ending at 'word'
-                for (size_t k = 1; k <= N_; ++k) {
-                        prefix = prefixes.read();
-                        ++freqs_[k][prefix + word];
-                        // Update prefix buffer for next word
-                        prefixes.write(prefix + word + " ");
-                        prefixes.lshift();
-                }
-                // Overwrite the last spurious N-gram prefix ending at 'word'
-                // With an empty prefix and realign prefix buffer
-                prefixes.rshift();
-                prefixes.write("");
+                if (instrumented) count_word(word != UNK_IND);
+                add_word(word, prefixes);
         }
 }
 
+/// @brief Increase the counts of the k-grams ending at a word.
+/// @param word A string. Index of the word.
+/// @param prefixes A buffer of the k-gram prefixes preceding 'word', which
+/// is updated to the ones following 'word'.
+void kgramFreqs::add_word(const std::string & word,
+                          CircularBuffer<std::string> & prefixes)
+{
+        ++freqs_[0][""]; // Increase total words count
+        std::string prefix;
+        // Increase k-gram counts for (k>1)-grams ending at 'word'
+        for (size_t k = 1; k <= N_; ++k) {
+                prefix = prefixes.read();
+                size_t count = ++freqs_[k][prefix + word];
+                if (word != BOS_IND)
+                        count_of_counts_.increment(k, count);
+                // Update prefix buffer for next word
+                prefixes.write(prefix + word + " ");
+                prefixes.lshift();
+        }
+        // Overwrite the last spurious N-gram prefix ending at 'word'
+        // With an empty prefix and realign prefix buffer
+        prefixes.rshift();
+        prefixes.write("");
+}
+
 /// @brief Retrieve counts for a given k-gram.
 /// @param kgram string. The k-gram to be queried.
 /// @return A positive integer. Number of occurrences of 'kgram' in the text data
@@ -50,8 +65,25 @@ void kgramFreqs::process_sentence(const std::string & sentence,
 double kgramFreqs::query (std::string kgram) const {
         auto p = kgram_code(kgram);
         if (p.first > N_) return -1;
-        auto it = freqs_[p.first].find(p.second);
-        return it != freqs_[p.first].end() ? it->second : 0;
+        return query(p.first, p.second);
+}
+
+/// @brief Retrieve counts for a given k-gram of word IDs.
+/// @param ids A vector of integers. IDs of the words of the k-gram, which 
+/// must be valid IDs (i.e. EOS_ID, BOS_ID, UNK_ID or dictionary words).
+/// @return A positive integer. Number of occurrences of the k-gram, or -1 if
+/// its order is larger than N.
+/// @details Equivalent to query(std::string), but the k-gram code is built 
+/// directly from the IDs, without tokenizing strings or looking words up in 
+/// the Dictionary.
+double kgramFreqs::query (const std::vector<int> & ids) const {
+        if (ids.size() > N_) return -1;
+        std::string code;
+        for (int id : ids) {
+                if (not code.empty()) code += ' ';
+                code += std::to_string(id);
+        }
+        return query(ids.size(), code);
 }
 
 /// @brief Initialize a buffer of prefixes for processing sentences
@@ -74,6 +106,27 @@ void kgramFreqs::add_BOS_counts(size_t n) {
                 padding += BOS_TOK + " ";
                 freqs_[k][dict_.kgram_code(padding).second] += n;
         }
+        n_sentences_ += n;
+}
+
+/// @brief Remove the counts of <BOS> <BOS> ... <BOS> (N times) added by 
+/// add_BOS_counts(), i.e. one per sentence processed, which are only stored 
+/// for orders lower than N.
+/// @details The k-gram may also occur in the processed text, if this 
+/// contains literal Begin-Of-Sentence tokens, in which case its count is 
+/// decreased rather than removed. Count-of-counts are unaffected, since 
+/// k-grams ending in <BOS> are not tracked, see CountOfCounts.
+void kgramFreqs::drop_BOS_counts() {
+        std::string padding = BOS_IND;
+        for (size_t k = 1; k < N_; ++k) 
+                padding += " " + BOS_IND;
+        auto it = freqs_[N_].find(padding);
+        if (it == freqs_[N_].end()) 
+                return;
+        if (it->second > n_sentences_) 
+                it->second -= n_sentences_;
+        else 
+                freqs_[N_].erase(it);
 }
 
 /// @brief store k-gram counts from a list of sentences.
@@ -90,9 +143,179 @@ void kgramFreqs::process_sentences(
         const std::vector<std::string> & sentences, bool fixed_dictionary
         ) 
 {
-        // Add counts for the various <BOS> <BOS> ... <BOS> paddings
-        add_BOS_counts(sentences.size());
-        for (const std::string & sentence : sentences) 
-                process_sentence(sentence, fixed_dictionary);
+        auto sentence_at = [&sentences](size_t i) -> const std::string & {
+                return sentences[i];
+        };
+        process_batch(sentences.size(), sentence_at, fixed_dictionary);
+}
+
+/// @brief Store k-gram counts from an encoded corpus.
+/// @param corpus An EncodedCorpus.
+/// @param fixed_dictionary true or false. If true, words of the corpus not
+/// appearing in the dictionary are replaced by an Unknown-Word token. 
+/// Otherwise, new words are added to the dictionary.
+/// @details The result coincides with the one of process_sentences() on the
+/// sentences encoded in 'corpus'. Since words are already tokenized and 
+/// coded, each distinct word is looked up in the dictionary only once, at 
+/// its first occurrence (so that new words are inserted in the same order 
+/// as by process_sentences()).
+void kgramFreqs::process_encoded(const EncodedCorpus & corpus, 
+                                 bool fixed_dictionary) 
+{
+        add_BOS_counts(corpus.n_sentences());
+        {
+                ScopedTimer timer(stats_.process_ns);
+                // Indices of word codes, empty if not yet looked up
+                std::vector<std::string> index(corpus.n_codes());
+                index[corpus_format::EOS_CODE] = EOS_IND;
+                index[corpus_format::UNK_CODE] = UNK_IND;
+                index[corpus_format::BOS_TOKEN_CODE] = BOS_IND;
+                index[corpus_format::EOS_TOKEN_CODE] = EOS_IND;
+                CircularBuffer<std::string> prefixes = padding_;
+                EncodedCorpus::Cursor cursor = corpus.cursor();
+                uint32_t code;
+                while (cursor.next(code)) {
+                        std::string & word = index[code];
+                        if (word.empty()) {
+                                const std::string & w = corpus.word(code);
+                                if (not fixed_dictionary and 
+                                    not dict_.contains(w))
+                                        dict_.insert(w);
+                                word = dict_.index(w);
+                        }
+                        add_word(word, prefixes);
+                        if (code == corpus_format::EOS_CODE)
+                                prefixes = padding_;
+                }
+        }
+        counts_changed();
+}
+
+/// @brief Build the right continuation index, if stale.
+/// @details Double-checked under followers_mutex_, so that concurrent first 
+/// calls of followers() build the index only once.
+void kgramFreqs::build_followers() const
+{
+        std::lock_guard<std::mutex> lock(followers_mutex_);
+        if (not followers_stale_.load(std::memory_order_relaxed))
+                return;
+        ScopedTimer timer(stats_.index_ns);
+        followers_.build(freqs_);
+        followers_stale_.store(false, std::memory_order_release);
+}
+
+/// @brief Check that a k-gram order is between 1 and the order N of a 
+/// kgramFreqs object.
+static size_t checked_order (size_t order, size_t N)
+{
+        if (order < 1 or order > N) throw std::domain_error(
+                "'N' must be positive and not larger than the order of the "
+                "k-gram frequency table."
+        );
+        return order;
+}
+
+/// @brief Copy constructor with reduced order, dropping satellites
+/// @param other a kgramFreqs object
+/// @param N Positive integer, not larger than other.N(). Maximum order of 
+/// k-grams of the copy.
+/// @details The result coincides with a copy of 'other' truncated by 
+/// truncate_order(), but frequency tables of order larger than N are never 
+/// copied.
+kgramFreqs::kgramFreqs(const kgramFreqs & other, size_t N)
+        : N_(checked_order(N, other.N_)), 
+          freqs_(other.freqs_.begin(), other.freqs_.begin() + N + 1), 
+          dict_(other.dict_),
+          padding_(generate_padding()), 
+          n_sentences_(other.n_sentences_),
+          index_followers_(other.index_followers_),
+          count_of_counts_(other.count_of_counts_),
+          version_(other.version_),
+          satellites_(0)
+{
+        if (N_ < other.N_)
+                drop_BOS_counts();
+        count_of_counts_.truncate(N_);
+}
+
+/// @brief Remove the satellite from the kgramFreqs it is registered with, 
+/// if this still exists, see kgramFreqs::~kgramFreqs().
+Satellite::~Satellite () { if (freqs_) freqs_->remove_satellite(this); }
+
+/// @brief Lower the maximum order of k-grams.
+/// @param N Positive integer, not larger than N(). New maximum order of 
+/// k-grams.
+/// @details Frequency tables of order larger than N are dropped, and their 
+/// memory released. Lower order tables, and the corresponding 
+/// count-of-counts and right continuation index, are left untouched, except 
+/// for the Begin-Of-Sentence padding of order N (see drop_BOS_counts()), so 
+/// that the result coincides with the counts obtained by processing the 
+/// original text with order N. Satellites are updated, and recompute their 
+/// quantities up to the new order; smoothers of order larger than N are 
+/// lowered to order N, see Smoother::OrderGuard.
+void kgramFreqs::truncate_order(size_t N)
+{
+        checked_order(N, N_);
+        if (N == N_) return;
+        N_ = N;
+        freqs_.resize(N + 1);
+        freqs_.shrink_to_fit();
+        drop_BOS_counts();
+        padding_ = generate_padding();
+        count_of_counts_.truncate(N);
+        if (not followers_stale_) 
+                followers_.truncate(N);
+        ++version_;
         update_satellites();
-}
\ No newline at end of file
+}
+
+/// @brief Replace the dictionary, remapping the stored k-gram counts.
+/// @param dict a Dictionary. The new dictionary of the model.
+/// @details Words of the current dictionary which are not included in 'dict'
+/// are replaced by the Unknown-Word token, and the counts of k-grams which 
+/// become identical after this replacement are merged. The result coincides
+/// with the counts obtained by processing the original text with 'dict' as a
+/// fixed dictionary, but the text is not needed: each frequency table is 
+/// recoded in a single pass, which also recomputes count-of-counts, while 
+/// entries of the old table are released as they are consumed. Words of 
+/// 'dict' not included in the current dictionary get zero counts.
+void kgramFreqs::remap_dictionary(const Dictionary & dict)
+{
+        // New indices of the old word IDs 0, 1, ..., V
+        std::vector<std::string> index(V() + 1);
+        for (size_t id = 0; id < index.size(); ++id)
+                index[id] = dict.index(dict_.word((int)id));
+        auto new_index = [&index](long id) -> const std::string & {
+                if (id >= 0) return index[id];
+                return id == BOS_ID ? BOS_IND : UNK_IND;
+        };
+        
+        count_of_counts_ = CountOfCounts(N_);
+        std::string key;
+        for (size_t k = 1; k <= N_; ++k) {
+                FrequencyTable & old_table = freqs_[k];
+                FrequencyTable table;
+                auto it = old_table.begin();
+                while (it != old_table.end()) {
+                        const char * p = it->first.c_str();
+                        char * end;
+                        long id = 0;
+                        key.clear();
+                        for (size_t j = 0; j < k; ++j) {
+                                id = std::strtol(p, &end, 10);
+                                p = end;
+                                if (j > 0) key += ' ';
+                                key += new_index(id);
+                        }
+                        size_t & count = table[key];
+                        size_t old_count = count;
+                        count += it->second;
+                        if (id != BOS_ID)
+                                count_of_counts_.increase(k, old_count, count);
+                        it = old_table.erase(it);
+                }
+                old_table.swap(table);
+        }
+        dict_ = dict;
+        counts_changed();
+}
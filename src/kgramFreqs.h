@@ -10,16 +10,39 @@
 #include <unordered_map>
 #include <utility>
 #include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "Dictionary.h"
 #include "WordStream.h"
 #include "CircularBuffer.h"
 #include "special_tokens.h"
 #include "Satellite.h"
+#include "Followers.h"
+#include "CountOfCounts.h"
+#include "Instrumentation.h"
+#include "EncodedCorpus.h"
 
 /// @class kgramFreqs
 /// @brief Store k-gram frequency counts in hash tables 
 
 class kgramFreqs {
+public:
+        /// @struct Stats
+        /// @brief Instrumentation counters, only maintained if the package 
+        /// is compiled with KGRAMS_INSTRUMENT defined, see Instrumentation.h.
+        struct Stats {
+                Counter lookups; ///< @brief k-gram count lookups, see query()
+                /// @brief Total size of the hash table buckets looked up, i.e.
+                /// number of keys compared in lookups (at most)
+                Counter probes; 
+                Counter words; ///< @brief Dictionary lookups of words
+                Counter unk; ///< @brief Words not found in the dictionary
+                Counter process_ns; ///< @brief Time in process_sentence()
+                Counter index_ns; ///< @brief Time building followers index
+                Counter satellites_ns; ///< @brief Time in update_satellites()
+        };
+private:
         //--------Aliases--------//
         /// k-gram frequency table type
         using FrequencyTable = std::unordered_map<std::string, size_t>;
@@ -44,7 +67,30 @@ class kgramFreqs {
         Dictionary dict_;
         
         /// @brief Begin-Of-Sentence padding
-        const CircularBuffer<std::string> padding_;
+        CircularBuffer<std::string> padding_;
+        
+        /// @brief Number of sentences processed, i.e. of Begin-Of-Sentence 
+        /// paddings counted by add_BOS_counts().
+        size_t n_sentences_ = 0;
+        
+        /// @brief Optional right continuation index (words following each
+        /// context), see Followers. Built on first use by followers(), and
+        /// rebuilt on the first use following a change of k-gram counts.
+        mutable Followers followers_;
+        bool index_followers_ = true;
+        /// @brief Whether followers_ must be (re)built before use, and mutex
+        /// guarding the build.
+        mutable std::atomic<bool> followers_stale_{true};
+        mutable std::mutex followers_mutex_;
+        
+        /// @brief Number of k-grams with small counts, see CountOfCounts.
+        CountOfCounts count_of_counts_;
+        
+        /// @brief Number of times k-gram counts have been modified
+        size_t version_ = 0;
+        
+        /// @brief Instrumentation counters, see Stats.
+        Stats stats_;
         //--------Private methods--------//
         
         /// @brief k-gram frequency satellites
@@ -55,10 +101,18 @@ class kgramFreqs {
         /// @brief Initialize a buffer of prefixes for processing sentences
         CircularBuffer<std::string> generate_padding();
         
+        /// @brief Build the right continuation index, if stale.
+        void build_followers () const; // kgramFreqs.cpp
+        
 protected:
         /// @brief Increase counts for <BOS>, <BOS> <BOS>, etc. by n
         void add_BOS_counts(size_t);
         
+        /// @brief Remove the counts of the padding <BOS> <BOS> ... <BOS> of 
+        /// order N, which are only stored for orders lower than N. 
+        /// Occurrences in the processed text are kept.
+        void drop_BOS_counts(); // kgramFreqs.cpp
+        
         /// @brief Get k-gram counts from sentence.
         /// The 'prefixes' buffer is supposed to be passed by value from the
         /// public method process_sentences(), in order to reinitialize it to 
@@ -67,8 +121,52 @@ protected:
                                bool fixed_dictionary = false
         ); // kgramFreqs.cpp
         
-        void update_satellites() 
-        { for (auto satellite : satellites_) satellite->update();}
+        /// @brief Get k-gram counts from a batch of sentences, and update the
+        /// derived quantities, see counts_changed().
+        /// @param n Number of sentences.
+        /// @param sentence Function returning the i-th sentence, for
+        /// i = 0, 1, ..., n - 1, called once for each i, in this order.
+        /// @param fixed_dictionary See process_sentences().
+        /// @details Shared by all interfaces processing plain text sentences,
+        /// so that none of these misses updates of derived quantities.
+        template <class Sentence>
+        void process_batch (size_t n, 
+                            Sentence sentence, 
+                            bool fixed_dictionary) 
+        {
+                // Add counts for the various <BOS> <BOS> ... <BOS> paddings
+                add_BOS_counts(n);
+                for (size_t i = 0; i < n; ++i)
+                        process_sentence(sentence(i), fixed_dictionary);
+                counts_changed();
+        }
+        
+        /// @brief Increase the counts of the k-grams ending at a word, given
+        /// the buffer of its prefixes.
+        void add_word (const std::string &, 
+                       CircularBuffer<std::string> &); // kgramFreqs.cpp
+        
+        void update_satellites() { 
+                ScopedTimer timer(stats_.satellites_ns);
+                for (auto satellite : satellites_) satellite->update();
+        }
+        
+        /// @brief Update the quantities derived from k-gram counts (right 
+        /// continuation index, version and satellites) after processing a 
+        /// batch of sentences. The index is only invalidated, so that 
+        /// processing text in batches does not pay for a rebuild per batch.
+        void counts_changed () {
+                followers_.clear();
+                followers_stale_ = true;
+                ++version_;
+                update_satellites();
+        }
+        
+        /// @brief Register a word lookup in the dictionary.
+        void count_word (bool found) const {
+                stats_.words.add();
+                if (not found) stats_.unk.add();
+        }
         
 public:
         //--------Constructors--------//
@@ -78,7 +176,10 @@ public:
         /// @details Constructs a kgramFreqs object of order N with an empty 
         /// dictionary.
         kgramFreqs(size_t N)
-                : N_(N), freqs_(N + 1), padding_(generate_padding()) 
+                : N_(N), 
+                  freqs_(N + 1), 
+                  padding_(generate_padding()), 
+                  count_of_counts_(N)
                 { freqs_[0][""] = 0; }
         
         /// @brief Constructor with predefined dictionary
@@ -103,9 +204,26 @@ public:
                   freqs_(other.freqs_), 
                   dict_(other.dict_),
                   padding_(other.padding_), 
+                  n_sentences_(other.n_sentences_),
+                  followers_(other.followers_),
+                  index_followers_(other.index_followers_),
+                  followers_stale_(other.followers_stale_.load()),
+                  count_of_counts_(other.count_of_counts_),
+                  version_(other.version_),
                   satellites_(0)
         {}
         
+        /// @brief Copy constructor with reduced order, dropping satellites
+        /// @param other a kgramFreqs object
+        /// @param N Positive integer, not larger than other.N(). Maximum 
+        /// order of k-grams of the copy.
+        /// @details Only k-gram tables up to order N are copied, see 
+        /// truncate_order().
+        kgramFreqs(const kgramFreqs & other, size_t N); // kgramFreqs.cpp
+        
+        /// @brief Destructor, detaching satellites, see Satellite.
+        ~kgramFreqs() { for (auto s : satellites_) s->freqs_ = nullptr; }
+        
         //--------Process k-gram counts--------//
         /// @brief store k-gram counts from a list of sentences.
         /// @param sentences Vector of strings. A list of sentences from 
@@ -120,10 +238,41 @@ public:
         void process_sentences(const std::vector<std::string> & sentences,
                                bool fixed_dictionary = false);
         
+        /// @brief Store k-gram counts from an encoded corpus, see 
+        /// EncodedCorpus.
+        void process_encoded (const EncodedCorpus &, 
+                              bool fixed_dictionary = false); // kgramFreqs.cpp
+        
+        /// @brief Replace the dictionary, remapping the stored k-gram counts.
+        void remap_dictionary (const Dictionary & dict); // kgramFreqs.cpp
+        
+        /// @brief Lower the maximum order of k-grams, releasing the memory of
+        /// higher order tables.
+        void truncate_order (size_t N); // kgramFreqs.cpp
+        
         //--------Query k-grams and words--------//
         // Get k-gram counts
         double query (std::string) const; // kgramFreqs.cpp
         
+        // Get k-gram counts from word IDs
+        double query (const std::vector<int> &) const; // kgramFreqs.cpp
+        
+        /// @brief Retrieve counts for a given k-gram code.
+        /// @param order a positive integer. Order of the k-gram.
+        /// @param code a string. k-gram code, see Dictionary::kgram_code().
+        /// @return A positive integer. Number of occurrences of the k-gram.
+        double query (size_t order, const std::string & code) const {
+                const FrequencyTable & table = freqs_[order];
+                auto it = table.find(code);
+                if (instrumented) {
+                        stats_.lookups.add();
+                        stats_.probes.add(
+                                table.bucket_size(table.bucket(code))
+                                );
+                }
+                return it != table.end() ? it->second : 0;
+        }
+        
         /// @brief Check if a word is found in the dictionary.
         /// @param word a string. Word to be queried.
         /// @return true or false.
@@ -135,11 +284,25 @@ public:
         /// @return a string.
         std::string word (std::string index) const { return dict_.word(index); }
         
+        /// @brief Return word from dictionary.
+        /// @param id an integer.
+        /// @return a string.
+        std::string word (int id) const { return dict_.word(id); }
+        
         /// @brief Return index of word from dictionary.
         /// @param word a string.
         /// @return a string.
         std::string index (std::string word) const { return dict_.index(word); }
         
+        /// @brief Return ID of word from dictionary.
+        /// @param word a string.
+        /// @return an integer.
+        int id (const std::string & word) const { 
+                int res = dict_.id(word);
+                if (instrumented) count_word(res != UNK_ID);
+                return res; 
+        }
+        
         /// @brief Return k-gram code from dictionary.
         /// @param kgram a string.
         /// @return a string.
@@ -173,7 +336,74 @@ public:
         
         const FrequencyTable & operator[] (size_t k) const { return freqs_[k]; }
         
-        void add_satellite(Satellite * s) { satellites_.push_back(s); }
+        //--------Right continuation index--------//
+        
+        /// @brief Check whether the right continuation index is enabled.
+        bool followers_index () const { return index_followers_; }
+        
+        /// @brief Enable (or disable) the right continuation index.
+        /// @param index true or false. If true (the default), the index is 
+        /// built on first use by followers(), otherwise it is removed, and 
+        /// callers scan the dictionary instead.
+        void set_followers_index (bool index) {
+                if (index == index_followers_)
+                        return;
+                index_followers_ = index;
+                if (not index) {
+                        followers_.clear();
+                        followers_stale_ = true;
+                }
+                // Satellites may keep indices of their own, see KNFreqs
+                update_satellites();
+        }
+        
+        /// @brief Retrieve the words observed after a given context.
+        /// @param order a positive integer. Order of the context.
+        /// @param context a string. Code of the context.
+        /// @return a list of Followers, sorted by decreasing count. Empty if 
+        /// the index is disabled, see set_followers_index().
+        /// @details The index is (re)built by the first call following a
+        /// change of k-gram counts. Calls can be made concurrently from 
+        /// several threads, as long as counts are not modified meanwhile.
+        const std::vector<Follower> & followers (
+                        size_t order, const std::string & context
+                ) const 
+        { 
+                if (index_followers_ and 
+                    followers_stale_.load(std::memory_order_acquire))
+                        build_followers();
+                return followers_.query(order, context); 
+        }
+        
+        /// @brief Number of times k-gram counts have been modified, 
+        /// which can be used to invalidate quantities derived from them.
+        size_t version () const { return version_; }
+        
+        /// @brief Number of k-grams with small counts, used for estimating 
+        /// discounts.
+        const CountOfCounts & count_of_counts () const 
+                { return count_of_counts_; }
+        
+        //--------Instrumentation--------//
+        
+        /// @brief Instrumentation counters, see Stats.
+        const Stats & stats () const { return stats_; }
+        
+        /// @brief Reset instrumentation counters.
+        void reset_stats () { stats_ = Stats(); }
+        
+        /// @brief Register a satellite, to be updated after k-gram counts 
+        /// change. The satellite removes itself when destroyed.
+        void add_satellite(Satellite * s) { 
+                satellites_.push_back(s); 
+                s->freqs_ = this;
+        }
+        
+        void remove_satellite(Satellite * s) {
+                auto it = std::find(satellites_.begin(), satellites_.end(), s);
+                if (it != satellites_.end()) satellites_.erase(it);
+                s->freqs_ = nullptr;
+        }
         
         /// @brief Return Dictionary.
         Dictionary dictionary() const { return dict_; };
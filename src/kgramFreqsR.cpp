@@ -19,6 +19,74 @@ IntegerVector kgramFreqsR::queryR(CharacterVector kgram) const
         return res;
 }
 
+/// @brief Retrieve counts for k-grams of word IDs, see kgramFreqs::query().
+/// @param kgrams An integer matrix. Each row contains the IDs of the words of
+/// a k-gram, NA entries being skipped.
+IntegerVector kgramFreqsR::query_idsR(IntegerMatrix kgrams) const
+{
+        size_t len = kgrams.nrow(), m = kgrams.ncol();
+        IntegerVector res(len);
+        std::vector<int> ids;
+        for (size_t i = 0; i < len; ++i) {
+                ids.clear();
+                for (size_t j = 0; j < m; ++j)
+                        if (kgrams(i, j) != NA_INTEGER) 
+                                ids.push_back(kgrams(i, j));
+                res[i] = query(ids);
+                if (res[i] == -1) res[i] = NA_INTEGER;
+        }
+        return res;
+}
+
+/// @brief IDs of words in the dictionary, see Dictionary::id().
+IntegerVector kgramFreqsR::idsR(CharacterVector word) const
+{
+        size_t len = word.length();
+        IntegerVector res(len);
+        for (size_t i = 0; i < len; ++i)
+                res[i] = id(as<std::string>(word[i]));
+        return res;
+}
+
+/// @brief Count-of-counts and closed form discount estimates for all k-gram
+/// orders, see CountOfCounts.
+DataFrame kgramFreqsR::discountsR() const
+{
+        const CountOfCounts & coc = count_of_counts();
+        size_t len = N();
+        IntegerVector order(len), n1(len), n2(len), n3(len), n4(len);
+        NumericVector D(len), D1(len), D2(len), D3(len);
+        for (size_t i = 0; i < len; ++i) {
+                size_t k = i + 1;
+                order[i] = k;
+                n1[i] = coc.n(k, 1); n2[i] = coc.n(k, 2); 
+                n3[i] = coc.n(k, 3); n4[i] = coc.n(k, 4);
+                D[i] = coc.D(k);
+                D1[i] = coc.D(k, 1); D2[i] = coc.D(k, 2); D3[i] = coc.D(k, 3);
+        }
+        return DataFrame::create(_["order"] = order, 
+                                 _["n1"] = n1, _["n2"] = n2, 
+                                 _["n3"] = n3, _["n4"] = n4, 
+                                 _["D"] = D, 
+                                 _["D1"] = D1, _["D2"] = D2, _["D3"] = D3);
+}
+
+/// @brief Instrumentation counters, see kgramFreqs::Stats. Times are in 
+/// seconds.
+NumericVector kgramFreqsR::statsR() const
+{
+        const Stats & s = stats();
+        return NumericVector::create(
+                _["lookups"] = (double)s.lookups.value(),
+                _["probes"] = (double)s.probes.value(),
+                _["words"] = (double)s.words.value(),
+                _["unk"] = (double)s.unk.value(),
+                _["process_sec"] = 1e-9 * s.process_ns.value(),
+                _["index_sec"] = 1e-9 * s.index_ns.value(),
+                _["satellites_sec"] = 1e-9 * s.satellites_ns.value()
+                );
+}
+
 /// @brief store k-gram counts from a list of sentences.
 /// @param sentences Vector of strings. A list of sentences from 
 /// which to store k-gram counts
@@ -34,17 +102,22 @@ void kgramFreqsR::process_sentencesR(
         CharacterVector & sentences, bool fixed_dictionary, bool verbose
         ) 
 {
-        add_BOS_counts(sentences.size());
         std::string sentence;
-        
         Progress p(sentences.size(), verbose);
-        auto itend = sentences.end();
-        for (auto it = sentences.begin(); it != itend; ++it) {
-                sentence = *it;
-                process_sentence(sentence, fixed_dictionary);
+        auto sentence_at = [&](size_t i) -> const std::string & {
+                sentence = sentences[i];
                 p.increment();
-        }
-        update_satellites();
+                return sentence;
+        };
+        process_batch(sentences.size(), sentence_at, fixed_dictionary);
+}
+
+/// @brief Store k-gram counts from a corpus encoded in a file, see 
+/// kgramFreqs::process_encoded().
+void kgramFreqsR::process_encodedR(std::string path, bool fixed_dictionary) 
+{
+        EncodedCorpus corpus(path);
+        process_encoded(corpus, fixed_dictionary);
 }
 
 RCPP_EXPOSED_CLASS(Dictionary);
@@ -55,16 +128,29 @@ RCPP_MODULE(kgramFreqs) {
         class_<kgramFreqs>("___kgramFreqs")
                 .property("N", &kgramFreqs::N)
                 .property("V", &kgramFreqs::V)
+                .property("followers_index", 
+                          &kgramFreqs::followers_index, 
+                          &kgramFreqs::set_followers_index)
                 .const_method("unique", &kgramFreqs::unique)
                 .const_method("tot_words", &kgramFreqs::tot_words)
+                .method("reset_stats", &kgramFreqs::reset_stats)
+                .method("remap_dictionary", &kgramFreqs::remap_dictionary)
+                .method("truncate_order", &kgramFreqs::truncate_order)
         ;
         
         class_<kgramFreqsR>("kgramFreqs")
                 .derives<kgramFreqs>("___kgramFreqs")
                 .constructor<size_t, const Dictionary & >()
                 .constructor<const kgramFreqsR & >()
+                .constructor<const kgramFreqsR &, size_t>()
                 .method("process_sentences", &kgramFreqsR::process_sentencesR)
+                .method("process_encoded", &kgramFreqsR::process_encodedR)
                 .const_method("query", &kgramFreqsR::queryR)
+                .const_method("query_ids", &kgramFreqsR::query_idsR)
+                .const_method("ids", &kgramFreqsR::idsR)
+                .const_method("discounts", &kgramFreqsR::discountsR)
                 .const_method("dictionary", &kgramFreqsR::dictionaryR)
+                .const_method("stats", &kgramFreqsR::statsR)
+                .const_method("instrumented", &kgramFreqsR::instrumentedR)
         ;
 }
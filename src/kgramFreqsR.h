@@ -9,6 +9,9 @@ class kgramFreqsR : public kgramFreqs {
 public:
         kgramFreqsR(size_t N) : kgramFreqs(N) {}
         kgramFreqsR(size_t N, const Dictionary & dict) : kgramFreqs(N, dict) {}
+        kgramFreqsR(const kgramFreqsR & other) : kgramFreqs(other) {}
+        kgramFreqsR(const kgramFreqsR & other, size_t N) 
+                : kgramFreqs(other, N) {}
         
         //--------Process k-gram counts--------//
         /// @brief store k-gram counts from a list of sentences.
@@ -26,7 +29,13 @@ public:
                 bool fixed_dictionary = false,
                 bool verbose = false
         );
+        void process_encodedR (std::string path, bool fixed_dictionary);
         Rcpp::IntegerVector queryR (Rcpp::CharacterVector) const;
+        Rcpp::IntegerVector query_idsR (Rcpp::IntegerMatrix) const;
+        Rcpp::IntegerVector idsR (Rcpp::CharacterVector) const;
+        Rcpp::DataFrame discountsR () const;
+        Rcpp::NumericVector statsR () const;
+        bool instrumentedR () const { return instrumented; }
         DictionaryR dictionaryR() const { return DictionaryR(dictionary()); };
 };
 
@@ -10,4 +10,9 @@ const std::string BOS_IND = "-1";
 const std::string UNK_TOK = "___UNK___";
 const std::string UNK_IND = "-2";
 
+// Integer word IDs, corresponding to the indices above
+const int EOS_ID = 0;
+const int BOS_ID = -1;
+const int UNK_ID = -2;
+
 #endif // SPECIAL_TOKENS_H
\ No newline at end of file